@@ -1,24 +1,176 @@
 #include "muon.h"
+#include "state.h"
+#include "place.h"
+
+double
+seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+state(int bench) {
+    const struct state *shared = state_open();
+    static struct state copy;
+
+    if(!shared) d("error: no state at %s", state_path());
+
+    if(bench) {
+        unsigned long reads = 0;
+        double start = seconds(), elapsed;
+
+        do {
+            for(unsigned i = 0; i < 1024; i++) state_read(shared, &copy);
+            reads += 1024;
+        } while((elapsed = seconds() - start) < 1);
+
+        printf("%.0f reads/s, %zu bytes per read\n", reads / elapsed, sizeof(copy));
+        state_close(shared);
+        return 0;
+    }
+
+    state_read(shared, &copy);
+    state_close(shared);
+
+    printf("focused 0x%08x monitor %u\n", copy.focused_window, copy.focused_monitor);
+
+    for(unsigned i = 0; i < copy.monitor_count; i++) {
+        const struct state_monitor *m = &copy.monitors[i];
+
+        printf("monitor %u %ux%u+%u+%u layout %u root-count %u root-size %f mirror %u window-gap %u border-width %u\n",
+            m->id, m->w, m->h, m->x, m->y, m->layout, m->root_count, m->root_size, m->mirror, m->window_gap, m->border_width);
+
+        for(unsigned j = 0; j < m->window_count; j++) {
+            const struct state_window *w = &m->windows[j];
+            printf(" window 0x%08x %ux%u+%u+%u flags 0x%x %.*s\n", w->id, w->w, w->h, w->x, w->y, w->flags, STATE_CLASS, w->class);
+        }
+    }
+
+    return 0;
+}
+
+// Places windows of random size on a 2560x1440 monitor until count are
+// floating, then keeps replacing the oldest one, timing each placement.
+int
+place(unsigned count) {
+    struct place place = { 0 };
+    struct place_rect area = { 0, 0, 2560, 1440 }, *windows = calloc(count, sizeof(*windows));
+    unsigned long placements = 0, fits = 0;
+    double start = seconds(), elapsed;
+
+    srand(1);
+
+    do {
+        for(unsigned n = 0; n < 1024; n++, placements++) {
+            unsigned slot = placements % count;
+
+            place_reset(&place);
+            for(unsigned i = 0; i < count && i < placements; i++) {
+                if(i != slot) place_add(&place, windows[i]);
+            }
+
+            struct place_rect *w = &windows[slot];
+            w->w = 200 + rand() % 600;
+            w->h = 150 + rand() % 450;
+            fits += place_find(&place, &area, w->w, w->h, &w->x, &w->y);
+        }
+    } while((elapsed = seconds() - start) < 1);
+
+    printf("%.0f placements/s with %u windows, %.1f%% without overlap\n",
+        placements / elapsed, count, 100.0 * fits / placements);
+
+    place_free(&place);
+    free(windows);
+
+    return 0;
+}
+
+// Sends command for the given number of seconds without waiting for
+// replies, a connection per command like muoc -n.
+int
+flood(unsigned duration, char **argv, int argc) {
+    char cmd[BUFSIZ];
+    size_t o = 0;
+    unsigned long sent = 0;
+    double start = seconds(), elapsed;
+
+    cmd[o++] = '!';
+
+    for(int i = 0; i < argc; i++) {
+        size_t length = strlen(argv[i]);
+        if(o + length + 1 >= sizeof(cmd)) break;
+        memcpy(cmd + o, argv[i], length);
+        o += length;
+        cmd[o++] = ' ';
+    }
+
+    struct sockaddr_un addr;
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path());
+
+    do {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 && send(fd, cmd, o, 0) > 0) sent++;
+        close(fd);
+    } while((elapsed = seconds() - start) < duration);
+
+    printf("%.0f commands/s for %.0fs\n", sent / elapsed, elapsed);
+
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
     char cmd[BUFSIZ];
-    unsigned n;
+    size_t o = 0;
+    int reply = true;
 
     if(argc < 2) d("error: arguments");
 
-    for(unsigned o = 0, c = sizeof(cmd), n = 0; --argc && ++argv && c > 0; o += n, c -= n)
-        n = snprintf(cmd + o, c, "%s ", *argv);
+    if(streq(argv[1], "state")) {
+        return state(argc > 2 && streq(argv[2], "bench"));
+    }
 
-    unsigned fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(streq(argv[1], "place-bench")) {
+        unsigned count = argc > 2 ? strtoul(argv[2], NULL, 10) : 32;
+        return place(count ? count : 1);
+    }
+
+    if(streq(argv[1], "flood-bench")) {
+        if(argc < 4) d("error: flood-bench <seconds> <command> [args]");
+        return flood(strtoul(argv[2], NULL, 10), argv + 3, argc - 3);
+    }
+
+    // -n: send and exit without waiting for a reply
+    if(streq(argv[1], "-n")) {
+        reply = false;
+        cmd[o++] = '!';
+        argc--;
+        argv++;
+    }
+
+    while(--argc && ++argv) {
+        size_t length = strlen(*argv);
+        if(o + length + 1 >= sizeof(cmd)) break;
+        memcpy(cmd + o, *argv, length);
+        o += length;
+        cmd[o++] = ' ';
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
     struct sockaddr_un addr;
     addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, "/tmp/muon-socket");
-    connect(fd, (struct sockaddr *) &addr, sizeof(addr));
-    send(fd, cmd, strlen(cmd), 0);
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path());
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) return 1;
+    send(fd, cmd, o, 0);
+
+    if(!reply) return 0;
 
     char res[BUFSIZ];
-    if((n = recv(fd, res, sizeof(res), 0)) > 0)
-        printf("%s", res);
+    ssize_t r;
+    while((r = recv(fd, res, sizeof(res), 0)) > 0)
+        fwrite(res, 1, r, stdout);
 
     close(fd);
 
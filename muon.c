@@ -1,45 +1,160 @@
 #include "muon.h"
 #include "node.h"
+#include "ring.h"
+#include "seq.h"
+#include "state.h"
+#include "timer.h"
+#include "place.h"
+#include "trace.h"
 
 struct geometry {
     unsigned x, y, w, h;
 };
 
+struct shadow {
+    struct geometry     geometry;
+    unsigned            border_width;
+    unsigned            border_color;
+    unsigned            mapped;
+    unsigned            sequence;
+};
+
+struct sync {
+    xcb_sync_counter_t  counter;
+    xcb_sync_alarm_t    alarm;
+    unsigned long long  value;
+    struct timer        timer;
+    unsigned            waiting;
+    unsigned            deferred;
+    struct geometry     next;
+};
+
+struct hints {
+    unsigned            base_w, base_h;
+    unsigned            min_w, min_h;
+    unsigned            max_w, max_h;
+    unsigned            inc_w, inc_h;
+};
+
+enum property {
+    PROPERTY_CLASS,
+    PROPERTY_NAME,
+    PROPERTY_HINTS,
+    PROPERTY_NORMAL_HINTS,
+    PROPERTY_STATE,
+    PROPERTY_MAX
+};
+
+#define PROPERTY_ALL    ((1 << PROPERTY_MAX) - 1)
+
+enum window_state {
+    STATE_FULLSCREEN    = 1 << 0,
+    STATE_ABOVE         = 1 << 1,
+    STATE_ATTENTION     = 1 << 2
+};
+
+struct properties {
+    unsigned                    stale;
+    unsigned                    pending;
+    unsigned                    queued;
+    xcb_get_property_cookie_t   cookies[PROPERTY_MAX];
+    xcb_get_property_cookie_t   legacy_name;
+};
+
+enum color_slot {
+    COLOR_ACTIVE,
+    COLOR_INACTIVE,
+    COLOR_FLOATING,
+    COLOR_URGENT,
+    COLOR_MAX
+};
+
+const char *color_names[COLOR_MAX] = {
+    [COLOR_ACTIVE]      = "active",
+    [COLOR_INACTIVE]    = "inactive",
+    [COLOR_FLOATING]    = "floating",
+    [COLOR_URGENT]      = "urgent",
+};
+
+struct color {
+    unsigned            rgb;
+    unsigned            pixel;
+    unsigned            used;
+};
+
 #define monitor_node(ptr) node_entry(ptr, struct monitor, node)
 #define window_node(ptr) node_entry(ptr, struct window, node)
 #define first_window(head) node_first_entry(head, struct window, node)
+#define window_position(ptr) seq_entry(ptr, struct window, position)
+// Fibonacci hashing: the product's high bits depend on every bit of the id,
+// the low bits only on the id's low bits.
+#define window_bucket(id) (&window_table[(uint32_t) ((id) * 2654435761u) >> (32 - WINDOW_TABLE_BITS)])
 
 struct monitor {
     unsigned            id;
+    xcb_randr_output_t  output;
     struct geometry     geometry;
     struct geometry     base_geometry;
     struct geometry     padding;
     struct node         windows;
+    struct seq          tiles;
+    struct seq          floats;
     unsigned            window_count;
     unsigned            root_count;
-    unsigned            floating_count;
     float               root_size;
     unsigned            mirror;
     unsigned            layout;
     unsigned            border_width;
     unsigned            window_gap;
+    unsigned            colors[COLOR_MAX];
     struct window       *curwin;
     struct window       *fullscreen;
+    unsigned            dirty;
+    unsigned            deferred;
+    unsigned long long  last_arrange;
+    struct timer        arrange_timer;
 
     struct node         node;
 };
 
 struct window {
-    char                name[MAXLEN];
+    char                class[MAXLEN];
+    char                instance[MAXLEN];
+    char                title[MAXLEN];
     xcb_window_t        id;
     struct window      *transient;
+    struct node         transients;
     struct geometry     geometry;
+    struct shadow       shadow;
+    struct sync         sync;
+    struct hints        hints;
+    struct properties   properties;
+    struct timer        ping_timer;
+    unsigned            can_ping;
+    unsigned            state;
+    unsigned            urgent_hint;
     struct monitor      *monitor;
     unsigned            floating;
     unsigned            px, py;
     unsigned            fullscreen;
+    unsigned            urgent;
+    unsigned            has_color;
+    unsigned            color;
+    unsigned            suspended;
+    unsigned            hidden;
+    unsigned            pending_notify;
+    unsigned            ignore_unmap;
+    unsigned            raised;
+    unsigned            stack_index;
+    unsigned            stacked;
 
     struct node         node;
+    struct node         transient_node;
+    struct node         hash_node;
+    struct node         stack_node;
+    struct node         sync_node;
+    struct node         property_node;
+    struct seq_node     position;
 };
 
 enum pointer_action {
@@ -52,13 +167,153 @@ struct pointer {
     struct window       *window;
     enum pointer_action action;
     unsigned            x, y;
+    unsigned            anchored;
     struct geometry     geometry;
 };
 
+enum command_type {
+    COMMAND_UNKNOWN,
+    COMMAND_QUIT,
+    COMMAND_RESTART,
+    COMMAND_BEGIN,
+    COMMAND_END,
+    COMMAND_DEBUG_WINDOW,
+    COMMAND_CHECK_SHADOW,
+    COMMAND_LIST_WINDOWS,
+    COMMAND_DUMP,
+    COMMAND_ROOT_COUNT,
+    COMMAND_ROOT_SIZE,
+    COMMAND_WINDOW_GAP,
+    COMMAND_BORDER_WIDTH,
+    COMMAND_PADDING,
+    COMMAND_FULLSCREEN,
+    COMMAND_FULLSCREEN_HIDE,
+    COMMAND_COLOR,
+    COMMAND_MIRROR,
+    COMMAND_GET,
+    COMMAND_MAKE_ROOT,
+    COMMAND_SELECT_WINDOW,
+    COMMAND_SHIFT_WINDOW,
+    COMMAND_NEXT_LAYOUT,
+    COMMAND_PREVIOUS_LAYOUT,
+    COMMAND_RESET_LAYOUT,
+    COMMAND_RULE,
+    COMMAND_GRAB_POINTER,
+    COMMAND_TRACK_POINTER,
+    COMMAND_UNGRAB_POINTER,
+    COMMAND_SEND_WINDOW,
+    COMMAND_CLOSE_WINDOW,
+    COMMAND_FOCUS_WINDOW,
+    COMMAND_FOCUS_MODE,
+    COMMAND_TOGGLE_FLOATING,
+    COMMAND_RELOAD,
+    COMMAND_MACRO,
+    COMMAND_ARRANGE_INTERVAL,
+    COMMAND_FOCUS_DELAY,
+    COMMAND_PING_TIMEOUT,
+    COMMAND_STATS_INTERVAL,
+    COMMAND_TRACE,
+    COMMAND_MAX
+};
+
+const char *command_names[COMMAND_MAX] = {
+    [COMMAND_UNKNOWN]           = "",
+    [COMMAND_QUIT]              = "quit",
+    [COMMAND_RESTART]           = "restart",
+    [COMMAND_BEGIN]             = "begin",
+    [COMMAND_END]               = "end",
+    [COMMAND_DEBUG_WINDOW]      = "debug-window",
+    [COMMAND_CHECK_SHADOW]      = "check-shadow",
+    [COMMAND_LIST_WINDOWS]      = "list-windows",
+    [COMMAND_DUMP]              = "dump",
+    [COMMAND_ROOT_COUNT]        = "root-count",
+    [COMMAND_ROOT_SIZE]         = "root-size",
+    [COMMAND_WINDOW_GAP]        = "window-gap",
+    [COMMAND_BORDER_WIDTH]      = "border-width",
+    [COMMAND_PADDING]           = "padding",
+    [COMMAND_FULLSCREEN]        = "fullscreen",
+    [COMMAND_FULLSCREEN_HIDE]   = "fullscreen-hide",
+    [COMMAND_COLOR]             = "color",
+    [COMMAND_MIRROR]            = "mirror",
+    [COMMAND_GET]               = "get",
+    [COMMAND_MAKE_ROOT]         = "make-root",
+    [COMMAND_SELECT_WINDOW]     = "select-window",
+    [COMMAND_SHIFT_WINDOW]      = "shift-window",
+    [COMMAND_NEXT_LAYOUT]       = "next-layout",
+    [COMMAND_PREVIOUS_LAYOUT]   = "previous-layout",
+    [COMMAND_RESET_LAYOUT]      = "reset-layout",
+    [COMMAND_RULE]              = "rule",
+    [COMMAND_GRAB_POINTER]      = "grab-pointer",
+    [COMMAND_TRACK_POINTER]     = "track-pointer",
+    [COMMAND_UNGRAB_POINTER]    = "ungrab-pointer",
+    [COMMAND_SEND_WINDOW]       = "send-window",
+    [COMMAND_CLOSE_WINDOW]      = "close-window",
+    [COMMAND_FOCUS_WINDOW]      = "focus-window",
+    [COMMAND_FOCUS_MODE]        = "focus-mode",
+    [COMMAND_TOGGLE_FLOATING]   = "toggle-floating",
+    [COMMAND_RELOAD]            = "reload",
+    [COMMAND_MACRO]             = "macro",
+    [COMMAND_ARRANGE_INTERVAL]  = "arrange-interval",
+    [COMMAND_FOCUS_DELAY]       = "focus-delay",
+    [COMMAND_PING_TIMEOUT]      = "ping-timeout",
+    [COMMAND_STATS_INTERVAL]    = "stats-interval",
+    [COMMAND_TRACE]             = "trace",
+};
+
+struct command {
+    enum command_type   type;
+    int                 fd;
+    unsigned            argc;
+    unsigned            arg;
+    char                *argv[MAXARGS];
+    char                scratch[32];
+    char                buffer[BUFSIZ];
+};
+
+struct response {
+    int                 fd;
+    char                *stream;
+    size_t              length;
+    char                data[BUFSIZ];
+};
+
+struct buffer {
+    char                *data;
+    size_t              length;
+    size_t              capacity;
+};
+
+struct macro_step {
+    enum command_type   type;
+    unsigned            argc;
+    char                *argv[MAXARGS];
+    unsigned            param[MAXARGS];
+};
+
+struct macro {
+    char                name[MAXLEN];
+    unsigned            step_count;
+    unsigned            params;
+    struct macro_step   *steps;
+    char                *strings;
+
+    struct node         node;
+};
+
+struct stats {
+    unsigned long       events;
+    unsigned long       commands;
+    unsigned long       merged;
+    unsigned long long  event_latency;
+    unsigned long long  event_latency_max;
+};
+
 struct rule {
     char                name[MAXLEN];
     unsigned            floating;
     unsigned            fullscreen;
+    unsigned            has_color;
+    unsigned            color;
 
     struct node         node;
 };
@@ -70,18 +325,157 @@ xcb_window_t            root;
 int                     default_screen;
 unsigned                w, h;
 unsigned                running = true;
+unsigned                restarting = false;
+const char              *config_path = NULL;
 xcb_atom_t              wm_delete_window_atom;
 xcb_atom_t              wm_protocols_atom;
+unsigned                sync_event_base = 0;
+unsigned                randr_event_base = 0;
+unsigned                monitors_changed = false;
 unsigned                batch = false;
+unsigned                deferring = false;
+unsigned                client_list_changed = false;
+unsigned                focus_mode = FOCUS_MODE;
+unsigned                fullscreen_hide = FULLSCREEN_HIDE;
 
 LIST(monitors);
 LIST(rules);
+LIST(macros);
+LIST(stack);
+LIST(syncs);
+LIST(property_updates);
+
+struct node             window_table[WINDOW_TABLE_SIZE];
+
+RING(struct command, QUEUE_SIZE) commands;
+RING(struct response, QUEUE_SIZE) responses;
+
+int                     command_event = -1;
+int                     response_event = -1;
+unsigned                ipc_running = true;
+pthread_t               ipc_thread;
+struct stats            stats;
+struct state            *shared_state = NULL;
+
+struct place            placement;
+struct geometry_store   *geometry_store = NULL;
+struct timer            geometry_timer;
+
+FILE                    *trace_file = NULL;
+char                    trace_path[MAXLEN];
+unsigned long long      trace_start;
+
+struct timers           timers;
+int                     timer_fd = -1;
+unsigned long long      timer_armed = 0;
+struct timer            focus_timer;
+struct timer            stats_timer;
+unsigned                arrange_interval = ARRANGE_INTERVAL;
+unsigned                focus_delay = FOCUS_DELAY;
+unsigned                ping_timeout = PING_TIMEOUT;
+unsigned                stats_interval = STATS_INTERVAL;
 
 struct monitor          *curmon = NULL;
 struct pointer          *pointer = NULL;
+struct window           *hover = NULL;
+unsigned                stack_clock = 0;
+unsigned                layout_changed = false;
+unsigned                enter_sequence = 0;
+unsigned                focus_sequence = 0;
+
+xcb_visualtype_t        *visual = NULL;
+struct color            color_cache[COLOR_CACHE_SIZE];
+unsigned                color_cache_count = 0;
+unsigned                color_clock = 0;
+unsigned                default_colors[COLOR_MAX];
+
+unsigned long long
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+buffer_printf(struct buffer *buffer, const char *format, ...) {
+    va_list args;
+
+    for(;;) {
+        size_t space = buffer->capacity - buffer->length;
+
+        va_start(args, format);
+        int n = vsnprintf(buffer->data + buffer->length, space, format, args);
+        va_end(args);
+
+        if(n < 0) return;
+
+        if((size_t) n < space) {
+            buffer->length += n;
+            return;
+        }
+
+        buffer->capacity = MAX(buffer->capacity * 2, buffer->length + n + 1);
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+}
+
+void
+buffer_json_string(struct buffer *buffer, const char *string) {
+    buffer_printf(buffer, "\"");
+
+    for(const unsigned char *c = (const unsigned char *) string; *c; c++) {
+        if(*c == '"' || *c == '\\') buffer_printf(buffer, "\\%c", *c);
+        else if(*c < 0x20) buffer_printf(buffer, "\\u%04x", *c);
+        else buffer_printf(buffer, "%c", *c);
+    }
+
+    buffer_printf(buffer, "\"");
+}
+
+// Titles end the line formats, so line breaks in them are escaped. dest
+// needs twice the space of src.
+void
+escape_line(char *dest, const char *src) {
+    for(; *src; src++) {
+        if(*src == '\\') *dest++ = '\\', *dest++ = '\\';
+        else if(*src == '\n') *dest++ = '\\', *dest++ = 'n';
+        else if(*src == '\r') *dest++ = '\\', *dest++ = 'r';
+        else *dest++ = *src;
+    }
+
+    *dest = 0;
+}
 
-unsigned                active_border_color = 0;
-unsigned                inactive_border_color = 0;
+// Class and instance sit between other fields, so blanks are escaped as
+// well and an empty one is written as `-'.
+void
+escape_field(char *dest, const char *src) {
+    if(!*src) {
+        strcpy(dest, "-");
+        return;
+    }
+
+    for(; *src; src++) {
+        if(*src == '\\') *dest++ = '\\', *dest++ = '\\';
+        else if(*src == '\n') *dest++ = '\\', *dest++ = 'n';
+        else if(*src == '\r') *dest++ = '\\', *dest++ = 'r';
+        else if(*src == '\t') *dest++ = '\\', *dest++ = 't';
+        else if(*src == ' ') *dest++ = '\\', *dest++ = 's';
+        else *dest++ = *src;
+    }
+
+    *dest = 0;
+}
+
+void
+schedule(struct timer *timer, unsigned ms) {
+    timer_start(&timers, timer, now() + ms * 1000000ULL);
+}
+
+void
+unschedule(struct timer *timer) {
+    timer_stop(&timers, timer);
+}
 
 xcb_get_geometry_reply_t *
 get_geometry(xcb_window_t id) {
@@ -95,23 +489,133 @@ get_attributes(xcb_window_t id) {
         xcb_get_window_attributes(connection, id), NULL);
 }
 
+void
+visual_setup(void) {
+    xcb_depth_iterator_t depth = xcb_screen_allowed_depths_iterator(screen);
+
+    for(; depth.rem; xcb_depth_next(&depth)) {
+        xcb_visualtype_iterator_t v = xcb_depth_visuals_iterator(depth.data);
+
+        for(; v.rem; xcb_visualtype_next(&v)) {
+            if(v.data->visual_id == screen->root_visual) {
+                visual = v.data;
+                return;
+            }
+        }
+    }
+}
+
 unsigned
-parse_color(char *color) {
-    xcb_colormap_t map = screen->default_colormap;
-    unsigned r, g, b, p = 0;
+scale_channel(unsigned value, unsigned mask) {
+    if(!mask) return 0;
 
-    if(sscanf(color + 1, "%02x%02x%02x", &r, &g, &b) == 3) {
-        r *= 0x101; g *= 0x101; b *= 0x101;
-        xcb_alloc_color_reply_t *reply = xcb_alloc_color_reply(connection,
-            xcb_alloc_color(connection, map, r, g, b), NULL);
+    unsigned shift = __builtin_ctz(mask);
+    unsigned max = mask >> shift;
 
-        if(reply) {
-            p = reply->pixel;
-            free(reply);
+    return ((value * max + 127) / 255) << shift;
+}
+
+unsigned
+color_in_use(unsigned pixel) {
+    struct monitor *monitor;
+    struct window *window;
+    struct rule *rule;
+
+    for(unsigned i = 0; i < COLOR_MAX; i++) {
+        if(default_colors[i] == pixel) return true;
+    }
+
+    each_node_entry(rule, &rules, node) {
+        if(rule->has_color && rule->color == pixel) return true;
+    }
+
+    each_node_entry(monitor, &monitors, node) {
+        for(unsigned i = 0; i < COLOR_MAX; i++) {
+            if(monitor->colors[i] == pixel) return true;
+        }
+
+        each_node_entry(window, &monitor->windows, node) {
+            if(window->has_color && window->color == pixel) return true;
+        }
+    }
+
+    return false;
+}
+
+unsigned
+color_pixel(unsigned rgb) {
+    unsigned r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+
+    // DirectColor pixels index a writable colormap per channel, so only
+    // TrueColor maps straight from the masks.
+    if(visual && visual->_class == XCB_VISUAL_CLASS_TRUE_COLOR) {
+        return
+            scale_channel(r, visual->red_mask) |
+            scale_channel(g, visual->green_mask) |
+            scale_channel(b, visual->blue_mask);
+    }
+
+    for(unsigned i = 0; i < color_cache_count; i++) {
+        if(color_cache[i].rgb == rgb) {
+            color_cache[i].used = ++color_clock;
+            return color_cache[i].pixel;
+        }
+    }
+
+    unsigned pixel = 0;
+    xcb_alloc_color_reply_t *reply = xcb_alloc_color_reply(connection,
+        xcb_alloc_color(connection, screen->default_colormap, r * 0x101, g * 0x101, b * 0x101), NULL);
+
+    if(!reply) return pixel;
+
+    pixel = reply->pixel;
+    free(reply);
+
+    if(color_cache_count < LENGTH(color_cache)) {
+        color_cache[color_cache_count++] = (struct color) { rgb, pixel, ++color_clock };
+        return pixel;
+    }
+
+    // A full cache gives up its least recently used entry. Its cell is only
+    // freed when nothing still draws with it; otherwise it stays allocated
+    // and uncached.
+    struct color *victim = &color_cache[0];
+
+    for(unsigned i = 1; i < color_cache_count; i++) {
+        if(color_cache[i].used < victim->used) victim = &color_cache[i];
+    }
+
+    if(!color_in_use(victim->pixel)) {
+        xcb_free_colors(connection, screen->default_colormap, 0, 1, &victim->pixel);
+    }
+
+    *victim = (struct color) { rgb, pixel, ++color_clock };
+
+    return pixel;
+}
+
+unsigned
+parse_color(const char *color, unsigned *pixel) {
+    unsigned rgb;
+
+    if(color[0] != '#' || strlen(color) != 7 || sscanf(color + 1, "%06x", &rgb) != 1) {
+        return false;
+    }
+
+    *pixel = color_pixel(rgb);
+
+    return true;
+}
+
+int
+parse_color_slot(const char *name) {
+    for(unsigned i = 0; i < COLOR_MAX; i++) {
+        if(streq(name, color_names[i])) {
+            return i;
         }
     }
 
-    return p;
+    return -1;
 }
 
 xcb_atom_t
@@ -145,7 +649,15 @@ xinerama_is_active(void) {
 
 void
 flush(void) {
-    if(batch) return;
+    if(batch || deferring) return;
+
+    // Enter notifies for windows that moved under the pointer carry the
+    // sequence of a request sent before this marker; pointer motion after
+    // it carries a later one.
+    if(layout_changed) {
+        enter_sequence = xcb_no_operation(connection).sequence;
+        layout_changed = false;
+    }
 
     xcb_flush(connection);
 
@@ -189,6 +701,30 @@ get_monitor_from_id(unsigned id) {
 void
 float_window(struct window *);
 
+void
+toggle_fullscreen(struct window *);
+
+void
+update_border_colors(struct monitor *);
+
+bool
+match_rule(const struct rule *, struct window *);
+
+const char *
+window_class(struct window *);
+
+const char *
+window_title(struct window *);
+
+void
+update_titles(void);
+
+void
+request_property(struct window *, enum property);
+
+void
+arrange(struct monitor *);
+
 void
 reset_layout(struct monitor *monitor) {
     monitor->root_count = ROOT_COUNT;
@@ -197,22 +733,47 @@ reset_layout(struct monitor *monitor) {
     monitor->layout = VERTICAL;
     monitor->window_gap = WINDOW_GAP;
     monitor->border_width = BORDER_WIDTH;
-    monitor->fullscreen = NULL;
-    monitor->floating_count = 0;
+
+    if(monitor->fullscreen) {
+        toggle_fullscreen(monitor->fullscreen);
+    }
 
     struct window *window;
     each_node_entry(window, &monitor->windows, node) {
         window->floating = false;
     }
 
+    seq_splice(&monitor->tiles, &monitor->floats);
+
     struct rule *rule;
     each_node_entry(rule, &rules, node) {
         each_node_entry(window, &monitor->windows, node) {
-            if(streq(rule->name, window->name)) {
+            if(match_rule(rule, window)) {
                 if(rule->floating) float_window(window);
             }
         }
     }
+    update_border_colors(monitor);
+}
+
+void
+arrange_expire(struct timer *timer) {
+    arrange(timer_entry(timer, struct monitor, arrange_timer));
+}
+
+// For key-repeated layout changes: arranges at most once per
+// arrange_interval, the last change in an interval wins.
+void
+arrange_throttled(struct monitor *monitor) {
+    if(timer_pending(&monitor->arrange_timer)) return;
+
+    unsigned long long next = monitor->last_arrange + arrange_interval * 1000000ULL;
+
+    if(!arrange_interval || now() >= next) {
+        arrange(monitor);
+    } else {
+        timer_start(&timers, &monitor->arrange_timer, next);
+    }
 }
 
 void
@@ -226,30 +787,122 @@ resize_monitor(struct monitor *monitor) {
     monitor->geometry.h -= monitor->padding.h;
 }
 
-void
+struct monitor *
 add_monitor(unsigned x, unsigned y, unsigned w, unsigned h) {
     struct monitor *monitor = malloc(sizeof(*monitor));
     static unsigned id = 0;
 
     monitor->id = ++id;
+    monitor->output = XCB_NONE;
     monitor->curwin = NULL;
     monitor->window_count = 0;
     monitor->base_geometry = (struct geometry) { x, y, w, h };
     monitor->padding = (struct geometry) { 0, 0, 0, 0 };
     monitor->fullscreen = NULL;
+    monitor->dirty = false;
+    monitor->deferred = false;
+    monitor->last_arrange = 0;
+    timer_init(&monitor->arrange_timer, arrange_expire);
 
     resize_monitor(monitor);
 
     node_init(&monitor->windows);
+    seq_init(&monitor->tiles);
+    seq_init(&monitor->floats);
     node_append(&monitor->node, &monitors);
 
     if(!curmon) {
         curmon = monitor;
     }
 
+    // Colours are not part of the layout, reset-layout keeps them.
+    memcpy(monitor->colors, default_colors, sizeof(monitor->colors));
     reset_layout(monitor);
 
     p("add monitor -> %d, %dx%d+%d+%d", monitor->id, w, h, x, y);
+
+    return monitor;
+}
+
+void
+sync_request(struct window *window) {
+    struct sync *sync = &window->sync;
+
+    sync->value += 1;
+
+    xcb_client_message_event_t event = {
+        .response_type  = XCB_CLIENT_MESSAGE,
+        .window         = window->id,
+        .format         = 32,
+        .type           = wm_protocols_atom,
+        .data.data32[0] = ewmh->_NET_WM_SYNC_REQUEST,
+        .data.data32[1] = XCB_CURRENT_TIME,
+        .data.data32[2] = sync->value & 0xffffffff,
+        .data.data32[3] = sync->value >> 32,
+    };
+
+    xcb_send_event(connection, 0, window->id,
+        XCB_EVENT_MASK_NO_EVENT, (char *) &event);
+
+    xcb_sync_change_alarm_value_list_t alarm = {
+        .value = { .hi = sync->value >> 32, .lo = sync->value & 0xffffffff },
+    };
+
+    xcb_sync_change_alarm_aux(connection, sync->alarm, XCB_SYNC_CA_VALUE, &alarm);
+
+    sync->waiting = true;
+    schedule(&sync->timer, SYNC_TIMEOUT);
+    node_append(&window->sync_node, &syncs);
+}
+
+void
+move_resize(struct window *, struct geometry *);
+
+// Geometry and border changes go through here so the request is remembered:
+// configure notifies the server sent before handling it are outdated.
+void
+configure_window(struct window *window, unsigned mask, const unsigned *values) {
+    window->shadow.sequence = xcb_configure_window(connection, window->id, mask, values).sequence;
+    layout_changed = true;
+}
+
+void
+sync_done(struct window *window) {
+    struct sync *sync = &window->sync;
+
+    sync->waiting = false;
+    node_remove(&window->sync_node);
+    unschedule(&sync->timer);
+
+    if(sync->deferred) {
+        sync->deferred = false;
+        move_resize(window, &sync->next);
+    }
+}
+
+void
+sync_expire(struct timer *timer) {
+    struct window *window = timer_entry(timer, struct window, sync.timer);
+
+    p("sync timeout for 0x%08x", window->id);
+    sync_done(window);
+}
+
+// A size change waits until the client has drawn the previous one; only the
+// latest target is kept. Returns true when geom was deferred.
+bool
+sync_throttle(struct window *window, const struct geometry *geom) {
+    if(!window->sync.counter) return false;
+    if(geom->w == window->shadow.geometry.w && geom->h == window->shadow.geometry.h) return false;
+
+    if(window->sync.waiting) {
+        window->sync.next = *geom;
+        window->sync.deferred = true;
+        return true;
+    }
+
+    sync_request(window);
+    return false;
 }
 
 void
@@ -261,7 +914,14 @@ move_resize(struct window *window, struct geometry  *geom) {
         XCB_CONFIG_WINDOW_HEIGHT;
     unsigned v[] = { geom->x, geom->y, geom->w, geom->h };
 
-    xcb_configure_window(connection, window->id, mask, v);
+    // a newer target always supersedes a resize deferred for a redraw
+    window->sync.deferred = false;
+
+    if(!memcmp(&window->shadow.geometry, geom, sizeof(*geom))) return;
+    if(sync_throttle(window, geom)) return;
+
+    window->shadow.geometry = *geom;
+    configure_window(window, mask, v);
 }
 
 void
@@ -269,88 +929,256 @@ move(struct window *window, unsigned x, unsigned y) {
     unsigned mask = XCB_CONFIG_WINDOW_X|XCB_CONFIG_WINDOW_Y;
     unsigned v[] = { x, y };
 
-    xcb_configure_window(connection, window->id, mask, v);
+    // the deferred resize must not put the window back when it is sent
+    if(window->sync.deferred) {
+        window->sync.next.x = x;
+        window->sync.next.y = y;
+    }
+
+    if(window->shadow.geometry.x == x && window->shadow.geometry.y == y) return;
+
+    window->shadow.geometry.x = x;
+    window->shadow.geometry.y = y;
+    configure_window(window, mask, v);
 }
 
 void
 resize(struct window *window, unsigned w, unsigned h) {
     unsigned mask = XCB_CONFIG_WINDOW_WIDTH|XCB_CONFIG_WINDOW_HEIGHT;
     unsigned v[] = { w, h };
+    struct geometry geom = { window->shadow.geometry.x, window->shadow.geometry.y, w, h };
 
-    xcb_configure_window(connection, window->id, mask, v);
-}
+    window->sync.deferred = false;
 
-void lower(struct window *window) {
-    unsigned v[] = { XCB_STACK_MODE_BELOW };
+    if(window->shadow.geometry.w == w && window->shadow.geometry.h == h) return;
+    if(sync_throttle(window, &geom)) return;
 
-    xcb_configure_window(connection, window->id,
-        XCB_CONFIG_WINDOW_STACK_MODE, v);
+    window->shadow.geometry.w = w;
+    window->shadow.geometry.h = h;
+    configure_window(window, mask, v);
 }
 
-void raise(struct window *window) {
-    unsigned v[] = { XCB_STACK_MODE_ABOVE };
+void
+stack_relative(struct window *window, struct window *sibling, unsigned mode) {
+    unsigned v[] = { sibling->id, mode };
 
     xcb_configure_window(connection, window->id,
-        XCB_CONFIG_WINDOW_STACK_MODE, v);
+        XCB_CONFIG_WINDOW_SIBLING|XCB_CONFIG_WINDOW_STACK_MODE, v);
+    layout_changed = true;
 }
 
 void
-set_border_width(struct window *window, unsigned width) {
-    unsigned v[1] = { width };
+stack_top(struct window *window) {
+    unsigned v[] = { XCB_STACK_MODE_ABOVE };
 
-    xcb_configure_window(connection, window->id,
-        XCB_CONFIG_WINDOW_BORDER_WIDTH, v);
+    xcb_configure_window(connection, window->id, XCB_CONFIG_WINDOW_STACK_MODE, v);
+    layout_changed = true;
 }
 
-void
-update_border_color(const struct window *window) {
-    unsigned border_color = inactive_border_color;
+unsigned
+stack_layer(struct window *window) {
+    unsigned layer = window->fullscreen ? 2 : window->floating ? 1 : 0;
 
-    if(window == window->monitor->curwin) {
-        border_color = active_border_color;
+    if(window->transient) {
+        layer = MAX(layer, stack_layer(window->transient));
     }
 
-    xcb_change_window_attributes(connection, window->id,
-        XCB_CW_BORDER_PIXEL, &border_color);
+    return layer;
+}
+
+int
+stack_compare(const void *a, const void *b) {
+    struct window *x = *(struct window **) a, *y = *(struct window **) b;
+    unsigned lx = stack_layer(x), ly = stack_layer(y);
+
+    if(lx != ly) return lx < ly ? -1 : 1;
+    return x->raised < y->raised ? -1 : x->raised > y->raised;
 }
 
 void
-set_border_color(struct window *window, unsigned color) {
-    xcb_change_window_attributes(connection, window->id,
-        XCB_CW_BORDER_PIXEL, &color);
+stack_emit(struct window *window, struct window **target, unsigned *n) {
+    struct window *child;
+
+    target[(*n)++] = window;
+    window->stacked = true;
+
+    each_node_entry(child, &window->transients, transient_node) {
+        if(!child->stacked && stack_layer(child) == stack_layer(window)) {
+            stack_emit(child, target, n);
+        }
+    }
 }
 
 void
-focus(struct window *window) {
-    if(curmon->curwin == window) return;
+restack(void) {
+    struct window *window;
+    unsigned n = 0, m = 0, i = 0;
 
-    if(curmon->curwin) {
-        set_border_color(curmon->curwin, inactive_border_color);
+    each_node_entry(window, &stack, stack_node) {
+        window->stack_index = n++;
+        window->stacked = false;
     }
 
-    if(window) {
-        xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
-            window->id, XCB_CURRENT_TIME);
-        set_border_color(window, active_border_color);
-        xcb_ewmh_set_active_window(ewmh, default_screen, window->id);
-        curmon->curwin = window;
+    if(n < 2) return;
 
-        p("focus window 0x%08x, monitor %d", window->id,
-            window->monitor->id);
-    } else {
-        xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
-            root, XCB_CURRENT_TIME);
-        curmon->curwin = NULL;
+    struct window *sorted[n], *target[n];
+    unsigned tail[n], previous[n], keep[n], length = 0;
 
-        p("focus root");
+    each_node_entry(window, &stack, stack_node)
+        sorted[i++] = window;
+
+    qsort(sorted, n, sizeof(*sorted), stack_compare);
+
+    for(i = 0; i < n; i++) {
+        window = sorted[i];
+        if(window->transient && stack_layer(window) == stack_layer(window->transient)) continue;
+        stack_emit(window, target, &m);
     }
-}
 
-void
-delete_window(struct window *window) {
-    xcb_client_message_event_t event = {
-        .response_type  = XCB_CLIENT_MESSAGE,
-        .window         = window->id,
+    /* the longest run of windows already in target order stays put */
+    for(i = 0; i < n; i++) {
+        unsigned lo = 0, hi = length;
+
+        while(lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if(target[tail[mid]]->stack_index < target[i]->stack_index) lo = mid + 1;
+            else hi = mid;
+        }
+
+        previous[i] = lo ? tail[lo - 1] : n;
+        tail[lo] = i;
+        if(lo == length) length++;
+        keep[i] = false;
+    }
+
+    if(length == n) return;
+
+    for(i = tail[length - 1]; i < n; i = previous[i])
+        keep[i] = true;
+
+    unsigned first = 0;
+    while(!keep[first]) first++;
+
+    for(i = 0; i < n; i++) {
+        if(keep[i]) continue;
+
+        if(i) {
+            stack_relative(target[i], target[i - 1], XCB_STACK_MODE_ABOVE);
+        } else {
+            stack_relative(target[i], target[first], XCB_STACK_MODE_BELOW);
+        }
+    }
+
+    p("restack %u of %u windows", n - length, n);
+
+    node_init(&stack);
+
+    for(i = 0; i < n; i++)
+        node_append(&target[i]->stack_node, &stack);
+}
+
+void
+raise_window(struct window *window) {
+    window->raised = ++stack_clock;
+    restack();
+}
+
+void
+set_border_width(struct window *window, unsigned width) {
+    unsigned v[1] = { width };
+
+    if(window->shadow.border_width == width) return;
+
+    window->shadow.border_width = width;
+    configure_window(window, XCB_CONFIG_WINDOW_BORDER_WIDTH, v);
+}
+
+unsigned
+border_color(const struct window *window) {
+    const unsigned *colors = window->monitor->colors;
+
+    if(window == curmon->curwin) return colors[COLOR_ACTIVE];
+    if(window->urgent) return colors[COLOR_URGENT];
+    if(window->has_color) return window->color;
+    if(window->floating) return colors[COLOR_FLOATING];
+
+    return colors[COLOR_INACTIVE];
+}
+
+void
+update_border_color(struct window *window) {
+    unsigned color = border_color(window);
+
+    if(window->shadow.border_color == color) return;
+
+    window->shadow.border_color = color;
+    xcb_change_window_attributes(connection, window->id,
+        XCB_CW_BORDER_PIXEL, &color);
+}
+
+void
+update_border_colors(struct monitor *monitor) {
+    struct window *window;
+
+    each_node_entry(window, &monitor->windows, node) {
+        update_border_color(window);
+    }
+}
+
+void
+focus(struct window *window) {
+    struct window *previous = curmon->curwin;
+
+    if(window && window->monitor != curmon) {
+        curmon = window->monitor;
+    } else if(window && previous == window) {
+        return;
+    }
+
+    curmon->curwin = window;
+
+    // Focus-in notifies for an earlier request carry an older sequence
+    // than this one and are ignored.
+    if(window) {
+        focus_sequence = xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
+            window->id, XCB_CURRENT_TIME).sequence;
+        xcb_ewmh_set_active_window(ewmh, default_screen, window->id);
+
+        p("focus window 0x%08x, monitor %d", window->id,
+            window->monitor->id);
+    } else {
+        focus_sequence = xcb_set_input_focus(connection, XCB_INPUT_FOCUS_POINTER_ROOT,
+            root, XCB_CURRENT_TIME).sequence;
+
+        p("focus root");
+    }
+
+    if(previous && previous != window) update_border_color(previous);
+    if(window) update_border_color(window);
+}
+
+void
+focus_monitor(struct monitor *monitor) {
+    if(!monitor || monitor == curmon) return;
+
+    p("monitor %d -> %d", curmon->id, monitor->id);
+
+    struct window *previous = curmon->curwin;
+    struct window *window = monitor->curwin;
+
+    curmon = monitor;
+    monitor->curwin = NULL;
+
+    if(previous) update_border_color(previous);
+
+    focus(window);
+}
+
+void
+delete_window(struct window *window) {
+    xcb_client_message_event_t event = {
+        .response_type  = XCB_CLIENT_MESSAGE,
+        .window         = window->id,
         .format         = 32,
         .sequence       = 0,
         .type           = wm_protocols_atom,
@@ -360,68 +1188,89 @@ delete_window(struct window *window) {
 
     xcb_send_event(connection, 0, window->id,
         XCB_EVENT_MASK_NO_EVENT, (char*)&event);
+
+    if(!window->can_ping || !ping_timeout || timer_pending(&window->ping_timer)) return;
+
+    event.data.data32[0] = ewmh->_NET_WM_PING;
+    event.data.data32[2] = window->id;
+
+    xcb_send_event(connection, 0, window->id,
+        XCB_EVENT_MASK_NO_EVENT, (char*)&event);
+
+    schedule(&window->ping_timer, ping_timeout);
 }
 
 struct window *
 find_window(xcb_window_t id) {
-    struct monitor *monitor;
     struct window *window;
 
-    each_node_entry(monitor, &monitors, node) {
-        each_node_entry(window, &monitor->windows, node) {
-            if(window->id == id) {
-                return window;
-            }
+    each_node_entry(window, window_bucket(id), hash_node) {
+        if(window->id == id) {
+            return window;
         }
     }
 
     return NULL;
 }
 
-struct window *
-query_pointer(unsigned *root_x, unsigned *root_y) {
-    xcb_query_pointer_reply_t *reply = xcb_query_pointer_reply(
-        connection, xcb_query_pointer(connection, root), NULL);
-
-    struct window *window = find_window(reply->child);
+struct seq *
+window_sequence(struct window *window) {
+    return window->floating ? &window->monitor->floats : &window->monitor->tiles;
+}
 
-    if(root_x) *root_x = reply->root_x;
-    if(root_y) *root_y = reply->root_y;
+struct window *
+first_tile(struct monitor *monitor) {
+    struct seq_node *first = seq_first(&monitor->tiles);
+    return first ? window_position(first) : NULL;
+}
 
-    return window;
+struct window *
+next_tile(struct window *window) {
+    struct seq_node *next = seq_next(&window->position);
+    return next ? window_position(next) : NULL;
 }
 
 struct window *
-first_tile(struct node *head) {
-    struct window *window;
+step_window(struct window *window, int count) {
+    struct monitor *monitor = window->monitor;
+    int tiles = seq_size(&monitor->tiles);
+    int total = tiles + seq_size(&monitor->floats);
+    int index = seq_index(&window->position) + (window->floating ? tiles : 0);
 
-    each_node_entry(window, head, node) {
-        if(!window->floating) {
-            return window;
-        }
-    }
+    index = ((index + count) % total + total) % total;
 
-    return NULL;
+    return index < tiles
+        ? window_position(seq_at(&monitor->tiles, index))
+        : window_position(seq_at(&monitor->floats, index - tiles));
 }
 
-struct window *
-next_tile(struct window *window) {
-    if(window->monitor->window_count > window->monitor->floating_count) {
-        struct window *next = window_node(node_next(&window->node,
-            &window->monitor->windows));
+void
+set_floating(struct window *window, unsigned floating) {
+    seq_remove(window_sequence(window), &window->position);
+    window->floating = floating;
+    seq_append(window_sequence(window), &window->position);
+}
 
-        if(next && next->floating) {
-            return next_tile(next);
-        }
+void
+apply_size_hints(const struct window *window, unsigned *w, unsigned *h) {
+    const struct hints *hints = &window->hints;
 
-        return next;
-    }
+    if(hints->inc_w > 1 && *w > hints->base_w) *w -= (*w - hints->base_w) % hints->inc_w;
+    if(hints->inc_h > 1 && *h > hints->base_h) *h -= (*h - hints->base_h) % hints->inc_h;
 
-    return NULL;
+    *w = MAX(*w, hints->min_w);
+    *h = MAX(*h, hints->min_h);
+
+    if(hints->max_w) *w = MIN(*w, hints->max_w);
+    if(hints->max_h) *h = MIN(*h, hints->max_h);
+
+    *w = MAX(*w, 1);
+    *h = MAX(*h, 1);
 }
 
 struct window *
 process(struct window *window, const char *p, unsigned x, unsigned y, unsigned w, unsigned h) {
+    apply_size_hints(window, &w, &h);
     p(" [%s] 0x%08x %dx%d+%d+%d", p, window->id, w, h, x, y);
     set_border_width(window, window->monitor->border_width);
     window->geometry = (struct geometry) { x, y, w, h };
@@ -432,9 +1281,16 @@ process(struct window *window, const char *p, unsigned x, unsigned y, unsigned w
 
 void
 arrange(struct monitor *monitor) {
-    if(batch) return;
+    if(batch || deferring) {
+        monitor->deferred = true;
+        return;
+    }
 
-    unsigned wc = monitor->window_count - monitor->floating_count;
+    monitor->deferred = false;
+    monitor->last_arrange = now();
+    unschedule(&monitor->arrange_timer);
+
+    unsigned wc = seq_size(&monitor->tiles);
 
     if(!wc) return;
 
@@ -442,13 +1298,17 @@ arrange(struct monitor *monitor) {
 
     if(monitor->fullscreen) {
         p(" *fullscreen");
+        monitor->dirty = true;
         return;
     }
 
-    struct window *window = first_tile(&monitor->windows);
+    monitor->dirty = false;
+
+    struct window *window = first_tile(monitor);
 
     if(wc == 1) {
         window->geometry = monitor->geometry;
+        apply_size_hints(window, &window->geometry.w, &window->geometry.h);
         move_resize(window, &window->geometry);
         set_border_width(window, 0);
         return;
@@ -529,976 +1389,4480 @@ arrange(struct monitor *monitor) {
 
 void
 print_window(struct window *window) {
-    xcb_get_geometry_reply_t *geom = get_geometry(window->id);
+    struct shadow *shadow = &window->shadow;
 
     p(" id:              0x%08x", window->id);
     p(" stored-geometry: %dx%d+%d+%d", window->geometry.w, window->geometry.h, window->geometry.x, window->geometry.y);
-    p(" real-geometry:   %dx%d+%d+%d", geom->width, geom->height, geom->x, geom->y);
-    p(" class:           %s", window->name);
+    p(" server-geometry: %dx%d+%d+%d", shadow->geometry.w, shadow->geometry.h, shadow->geometry.x, shadow->geometry.y);
+    p(" border-width:    %u", shadow->border_width);
+    p(" mapped:          %s", shadow->mapped ? "true" : "false");
+    p(" class:           %s", window_class(window));
+    p(" instance:        %s", window->instance);
+    p(" title:           %s", window_title(window));
     p(" monitor:         %u", window->monitor->id);
     p(" fullscreen:      %s", window->fullscreen ? "true" : "false");
     p(" floating:        %s", window->floating ? "true" : "false");
 
     if(window->transient) {
-        p(" transient for:   0x%08x -> %s", window->transient->id, window->transient->name);
+        p(" transient for:   0x%08x -> %s", window->transient->id, window->transient->class);
     } else {
         p(" transient for:   n/a");
     }
-
-    free(geom);
 }
 
+#define json_bool(b)    ((b) ? "true" : "false")
+
 void
-store_geometry(struct window *window) {
-    xcb_get_geometry_reply_t *geom = get_geometry(window->id);
+dump_json(struct buffer *buffer) {
+    struct monitor *monitor;
+    struct window *window;
+    unsigned first_monitor = true;
 
-    window->geometry = (struct geometry) {
-        geom->x, geom->y, geom->width, geom->height
-    };
+    buffer_printf(buffer, "{\"focus-mode\":\"%s\",\"fullscreen-hide\":%s,\"monitor\":%u,\"monitors\":[",
+        focus_mode == FOCUS_POINTER ? "pointer" : "click", json_bool(fullscreen_hide), curmon->id);
+
+    each_node_entry(monitor, &monitors, node) {
+        const struct geometry *g = &monitor->base_geometry;
+        unsigned first_window = true;
+
+        buffer_printf(buffer, "%s{\"id\":%u,\"geometry\":[%u,%u,%u,%u]", first_monitor ? "" : ",", monitor->id, g->x, g->y, g->w, g->h);
+        buffer_printf(buffer, ",\"padding\":[%u,%u,%u,%u]", monitor->padding.x, monitor->padding.y, monitor->padding.w, monitor->padding.h);
+        buffer_printf(buffer, ",\"layout\":\"%s\",\"root-count\":%u,\"root-size\":%f,\"mirror\":%s",
+            monitor->layout == VERTICAL ? "vertical" : "horizontal", monitor->root_count, monitor->root_size, json_bool(monitor->mirror));
+        buffer_printf(buffer, ",\"window-gap\":%u,\"border-width\":%u", monitor->window_gap, monitor->border_width);
+        buffer_printf(buffer, ",\"focused\":\"0x%08x\",\"fullscreen\":\"0x%08x\",\"windows\":[",
+            monitor->curwin ? monitor->curwin->id : 0, monitor->fullscreen ? monitor->fullscreen->id : 0);
+
+        struct seq *sequences[] = { &monitor->tiles, &monitor->floats };
+
+        for(unsigned i = 0; i < LENGTH(sequences); i++) {
+            each_seq_entry(window, sequences[i], position) {
+                const struct geometry *wg = &window->shadow.geometry;
+
+                buffer_printf(buffer, "%s{\"id\":\"0x%08x\",\"class\":", first_window ? "" : ",", window->id);
+                buffer_json_string(buffer, window->class);
+                buffer_printf(buffer, ",\"instance\":");
+                buffer_json_string(buffer, window->instance);
+                buffer_printf(buffer, ",\"title\":");
+                buffer_json_string(buffer, window->title);
+                buffer_printf(buffer, ",\"geometry\":[%u,%u,%u,%u]", wg->x, wg->y, wg->w, wg->h);
+                buffer_printf(buffer, ",\"floating\":%s,\"fullscreen\":%s,\"urgent\":%s,\"hidden\":%s",
+                    json_bool(window->floating), json_bool(window->fullscreen), json_bool(window->urgent), json_bool(window->hidden));
+                buffer_printf(buffer, ",\"transient-for\":\"0x%08x\"}", window->transient ? window->transient->id : 0);
+
+                first_window = false;
+            }
+        }
+
+        buffer_printf(buffer, "]}");
+        first_monitor = false;
+    }
 
-    free(geom);
+    buffer_printf(buffer, "]}\n");
 }
 
 void
-float_window(struct window *window) {
-    if(window->floating) return;
-
-    p("floating window 0x%08x -> `%s'", window->id, window->name);
+dump_lines(struct buffer *buffer) {
+    struct monitor *monitor;
+    struct window *window;
 
-    raise(window);
+    buffer_printf(buffer, "wm focus-mode %s fullscreen-hide %s monitor %u\n",
+        focus_mode == FOCUS_POINTER ? "pointer" : "click", fullscreen_hide ? "true" : "false", curmon->id);
 
-    window->floating = true;
-    window->monitor->floating_count += 1;
-    store_geometry(window);
+    each_node_entry(monitor, &monitors, node) {
+        const struct geometry *g = &monitor->base_geometry;
+
+        buffer_printf(buffer, "monitor %u %ux%u+%u+%u layout %s root-count %u root-size %f mirror %s window-gap %u border-width %u focused 0x%08x\n",
+            monitor->id, g->w, g->h, g->x, g->y,
+            monitor->layout == VERTICAL ? "vertical" : "horizontal",
+            monitor->root_count, monitor->root_size, monitor->mirror ? "true" : "false",
+            monitor->window_gap, monitor->border_width, monitor->curwin ? monitor->curwin->id : 0);
+
+        struct seq *sequences[] = { &monitor->tiles, &monitor->floats };
+
+        for(unsigned i = 0; i < LENGTH(sequences); i++) {
+            each_seq_entry(window, sequences[i], position) {
+                const struct geometry *wg = &window->shadow.geometry;
+                char title[2 * MAXLEN], class[2 * MAXLEN], instance[2 * MAXLEN];
+
+                escape_line(title, window->title);
+                escape_field(class, window->class);
+                escape_field(instance, window->instance);
+                buffer_printf(buffer, "window 0x%08x monitor %u %ux%u+%u+%u flags %s%s%s%s transient 0x%08x class %s instance %s title %s\n",
+                    window->id, monitor->id, wg->w, wg->h, wg->x, wg->y,
+                    window->floating ? "f" : "-", window->fullscreen ? "F" : "-",
+                    window->urgent ? "u" : "-", window->hidden ? "h" : "-",
+                    window->transient ? window->transient->id : 0,
+                    class, instance, title);
+            }
+        }
+    }
 }
 
+// Built from cached state, with stale titles fetched in one pass. The
+// result is handed to the IPC thread as a heap buffer, so there is no size
+// limit.
 void
-toggle_floating(struct window *window) {
-    if(window->floating) {
-        window->floating = false;
-        window->monitor->floating_count -= 1;
-        lower(window);
-    } else  {
-        window->floating = true;
-        window->monitor->floating_count += 1;
-        raise(window);
+dump(struct response *reply, const char *format) {
+    struct buffer buffer = { malloc(BUFSIZ), 0, BUFSIZ };
+
+    update_titles();
+
+    if(format && streq(format, "json")) {
+        dump_json(&buffer);
+    } else {
+        dump_lines(&buffer);
     }
+
+    reply->stream = buffer.data;
+    reply->length = buffer.length;
 }
 
+// Class is kept current from property notifies; titles changed since they
+// were last read are fetched in one pipelined pass.
 void
-toggle_fullscreen(struct window *window) {
+list_windows(char *response) {
     struct monitor *monitor;
+    struct window *window;
+    unsigned o = 0;
+
+    update_titles();
 
-    // OK?
     each_node_entry(monitor, &monitors, node) {
-        if(monitor != window->monitor && monitor->fullscreen) {
-            toggle_fullscreen(monitor->fullscreen);
-        }
-    }
+        each_node_entry(window, &monitor->windows, node) {
+            char title[2 * MAXLEN], class[2 * MAXLEN], instance[2 * MAXLEN];
 
-    monitor = window->monitor;
+            if(o >= BUFSIZ) return;
 
-    if(window->fullscreen) {
-        p("unset fullscreen");
-        window->fullscreen = false;
-        window->monitor->fullscreen = NULL;
-        xcb_atom_t atoms[] = { XCB_NONE };
-        xcb_ewmh_set_wm_state(ewmh, window->id, LENGTH(atoms), atoms);
-        if(!window->floating) {
-            lower(window);
-            arrange(monitor);
-        } else {
-            move_resize(window, &window->geometry);
+            escape_line(title, window->title);
+            escape_field(class, window->class);
+            escape_field(instance, window->instance);
+            o += snprintf(response + o, BUFSIZ - o, "0x%08x %u %s %s %s\n",
+                window->id, monitor->id, class, instance, title);
         }
-    } else {
-        p("set fullscreen");
-        window->fullscreen = true;
-        monitor->fullscreen = window;
-        xcb_atom_t atoms[] = { ewmh->_NET_WM_STATE_FULLSCREEN };
-        xcb_ewmh_set_wm_state(ewmh, window->id, LENGTH(atoms), atoms);
-        set_border_width(window, 0);
-        move_resize(window, &monitor->geometry);
-        raise(window);
     }
 }
 
 void
-update_client_list(void) {
+check_shadow(char *response) {
     struct monitor *monitor;
     struct window *window;
-    unsigned n = 0;
+    unsigned n = 0, i = 0, bad = 0, o = 0;
 
     each_node_entry(monitor, &monitors, node)
-        each_node_entry(window, &monitor->windows, node)
-            n++;
+        n += monitor->window_count;
 
-    if(!n) {
-        xcb_ewmh_set_client_list(ewmh, default_screen, 0, NULL);
+    if(!n) return;
+
+    xcb_get_geometry_cookie_t geometry[n];
+    xcb_get_window_attributes_cookie_t attributes[n];
+
+    each_node_entry(monitor, &monitors, node) {
+        each_node_entry(window, &monitor->windows, node) {
+            geometry[i] = xcb_get_geometry(connection, window->id);
+            attributes[i] = xcb_get_window_attributes(connection, window->id);
+            i++;
+        }
     }
 
-    xcb_window_t windows[n];
-    unsigned i = 0;
+    i = 0;
 
-    each_node_entry(monitor, &monitors, node)
-        each_node_entry(window, &monitor->windows, node)
-            windows[i++] = window->id;
+    each_node_entry(monitor, &monitors, node) {
+        each_node_entry(window, &monitor->windows, node) {
+            xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(connection, geometry[i], NULL);
+            xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(connection, attributes[i], NULL);
+            struct shadow *shadow = &window->shadow;
+            i++;
+
+            if(!geom || !attr) {
+                bad++;
+                if(o < BUFSIZ) {
+                    o += snprintf(response + o, BUFSIZ - o, "0x%08x unknown to the server\n", window->id);
+                }
+            } else if(
+                shadow->geometry.x != (unsigned) geom->x ||
+                shadow->geometry.y != (unsigned) geom->y ||
+                shadow->geometry.w != geom->width ||
+                shadow->geometry.h != geom->height ||
+                shadow->border_width != geom->border_width ||
+                shadow->mapped != (attr->map_state != XCB_MAP_STATE_UNMAPPED)) {
+                bad++;
+                if(o < BUFSIZ) {
+                    o += snprintf(response + o, BUFSIZ - o,
+                        "0x%08x shadow %ux%u+%u+%u/%u %s, server %ux%u+%d+%d/%u %s\n", window->id,
+                        shadow->geometry.w, shadow->geometry.h, shadow->geometry.x, shadow->geometry.y,
+                        shadow->border_width, shadow->mapped ? "mapped" : "unmapped",
+                        geom->width, geom->height, geom->x, geom->y,
+                        geom->border_width, attr->map_state != XCB_MAP_STATE_UNMAPPED ? "mapped" : "unmapped");
+                }
+            }
 
-    xcb_ewmh_set_client_list(ewmh, default_screen, n, windows);
+            free(geom);
+            free(attr);
+        }
+    }
+
+    if(o < BUFSIZ) {
+        snprintf(response + o, BUFSIZ - o, "%u windows, %u inconsistent\n", n, bad);
+    }
 }
 
-struct window *
-add_window(struct monitor *monitor, xcb_window_t id) {
-    struct window *window = malloc(sizeof(*window));
+// Moves a floating window into the largest free area of its monitor, clear
+// of other floating windows and the focused window, if there is room.
+void
+place_window(struct window *window) {
+    struct monitor *monitor = window->monitor;
+    struct geometry *area = &monitor->geometry;
+    int gap = monitor->window_gap, border = 2 * window->shadow.border_width;
+    struct window *other;
 
-    window->monitor = monitor;
-    window->id = id;
-    window->floating = false;
-    window->fullscreen = false;
+    place_reset(&placement);
 
-    monitor->window_count += 1;
+    each_seq_entry(other, &monitor->floats, position) {
+        if(other == window || other->hidden) continue;
 
-    xcb_icccm_get_wm_class_reply_t class;
+        int outer = 2 * other->shadow.border_width;
+        place_add(&placement, (struct place_rect) {
+            other->geometry.x - gap, other->geometry.y - gap,
+            other->geometry.w + outer + 2 * gap, other->geometry.h + outer + 2 * gap
+        });
+    }
 
-    if(xcb_icccm_get_wm_class_reply(connection, xcb_icccm_get_wm_class(connection, id), &class, NULL)) {
-        strncpy(window->name, class.class_name, sizeof(window->name));
-        xcb_icccm_get_wm_class_reply_wipe(&class);
+    if((other = monitor->curwin) && other != window && !other->floating) {
+        place_add(&placement, (struct place_rect) {
+            other->geometry.x, other->geometry.y,
+            other->geometry.w + 2 * other->shadow.border_width, other->geometry.h + 2 * other->shadow.border_width
+        });
     }
 
-    p("add window 0x%08x -> `%s', monitor %d", id, window->name, monitor->id);
+    struct place_rect bounds = { area->x + gap, area->y + gap, area->w - 2 * gap, area->h - 2 * gap };
+    int x, y;
 
-    xcb_window_t transient = XCB_NONE;
+    if(!place_find(&placement, &bounds, window->geometry.w + border, window->geometry.h + border, &x, &y)) {
+        debug("no free area for 0x%08x, using the largest gap", window->id);
+    }
 
-    xcb_icccm_get_wm_transient_for_reply(connection, xcb_icccm_get_wm_transient_for_unchecked(connection, id), &transient, NULL);
+    window->geometry.x = MAX(x, (int) area->x);
+    window->geometry.y = MAX(y, (int) area->y);
 
-    /*
-    FIXME
-    if((window->transient = find_window(transient))) {
-        p("window is transient for 0x%08x -> `%s'", window->transient->id, window->transient->name);
-        float_window(window);
+    move(window, window->geometry.x, window->geometry.y);
+}
+
+/*
+ * Last floating geometry per class and instance, relative to the monitor,
+ * kept in a fixed-size file mapped shared. Updates only touch memory; the
+ * kernel writes the pages back on its own and an msync(MS_ASYNC) is
+ * scheduled after changes, so nothing here waits on the disk. When all
+ * slots are taken the least recently used one is replaced.
+ */
+
+struct geometry_slot {
+    char                class[GEOMETRY_NAME];
+    char                instance[GEOMETRY_NAME];
+    int32_t             x, y;
+    uint32_t            w, h;
+    uint32_t            stamp;
+};
 
-        unsigned x = window->transient->geometry.x + (window->transient->geometry.w / 2) - (window->geometry.w / 2);
-        unsigned y = window->transient->geometry.y + (window->transient->geometry.h / 2) - (window->geometry.h / 2);
+struct geometry_store {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            slot_count;
+    uint32_t            clock;
+    struct geometry_slot slots[GEOMETRY_SLOTS];
+};
 
-        move(window, x, y); // FIXME
+void
+geometry_sync(struct timer *timer) {
+    if(msync(geometry_store, sizeof(*geometry_store), MS_ASYNC) < 0) {
+        p("warning: could not sync geometry store");
     }
-    */
+}
 
-    xcb_ewmh_get_atoms_reply_t atoms;
+void
+geometry_setup(void) {
+    const char *home = getenv("HOME");
+    char path[MAXLEN];
 
-    if(xcb_ewmh_get_wm_window_type_reply(ewmh, xcb_ewmh_get_wm_window_type(ewmh, window->id), &atoms, NULL)) {
-        for(unsigned i = 0; i < atoms.atoms_len; i++) {
-            xcb_atom_t atom = atoms.atoms[i];
-            if(atom == ewmh->_NET_WM_WINDOW_TYPE_DIALOG) {
-                p("window-type dialog");
-                float_window(window);
-                break;
-            }
-        }
+    timer_init(&geometry_timer, geometry_sync);
 
-        xcb_ewmh_get_atoms_reply_wipe(&atoms);
+    if(!home || snprintf(path, sizeof(path), "%s/" GEOMETRY_FILE, home) >= (int) sizeof(path)) return;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+    if(fd < 0 || !state_owned(fd) || ftruncate(fd, sizeof(*geometry_store)) < 0) {
+        p("warning: could not open %s", path);
+        if(fd >= 0) close(fd);
+        return;
     }
 
-    struct rule *rule;
+    geometry_store = mmap(NULL, sizeof(*geometry_store), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
 
-    each_node_entry(rule, &rules, node) {
-        if(streq(rule->name, window->name)) {
-            if(rule->floating) {
-                float_window(window);
-            }
+    if(geometry_store == MAP_FAILED) {
+        geometry_store = NULL;
+        return;
+    }
 
-            if(rule->fullscreen) {
-                toggle_fullscreen(window);
-            }
-        }
+    if(geometry_store->magic != GEOMETRY_MAGIC || geometry_store->version != GEOMETRY_VERSION ||
+       geometry_store->slot_count != GEOMETRY_SLOTS) {
+        memset(geometry_store, 0, sizeof(*geometry_store));
+        geometry_store->magic = GEOMETRY_MAGIC;
+        geometry_store->version = GEOMETRY_VERSION;
+        geometry_store->slot_count = GEOMETRY_SLOTS;
     }
+}
 
-    set_border_width(window, monitor->border_width);
-    set_border_color(window, inactive_border_color);
+struct geometry_slot *
+find_geometry(struct window *window) {
+    window_class(window);
 
-    monitor->curwin ? node_insert(&window->node, &monitor->curwin->node)
-                    : node_insert(&window->node, &monitor->windows);
+    if(!geometry_store || !window->class[0]) return NULL;
 
-    update_client_list(); // FIXME
+    for(unsigned i = 0; i < GEOMETRY_SLOTS; i++) {
+        struct geometry_slot *slot = &geometry_store->slots[i];
 
-    return window;
+        if(slot->stamp &&
+           !strncmp(slot->class, window->class, GEOMETRY_NAME - 1) &&
+           !strncmp(slot->instance, window->instance, GEOMETRY_NAME - 1)) {
+            return slot;
+        }
+    }
+
+    return NULL;
 }
 
-unsigned
-remove_window(struct window *window) {
-    struct monitor *monitor = window->monitor;
+// Transients are centered on their parent instead of recalled, so their
+// geometry is not recorded either.
+void
+remember_geometry(struct window *window) {
+    struct geometry_slot *slot;
 
-    p("remove window 0x%08x -> `%s', monitor %d", window->id, window->name, monitor->id);
+    if(!window->floating || window->fullscreen || window->transient) return;
 
-    monitor->window_count -= 1;
+    if(!(slot = find_geometry(window))) {
+        if(!geometry_store || !window->class[0]) return;
 
-    node_remove(&window->node);
+        slot = &geometry_store->slots[0];
 
-    if(window->fullscreen) {
-        monitor->fullscreen = NULL;
+        for(unsigned i = 1; i < GEOMETRY_SLOTS && slot->stamp; i++) {
+            if(geometry_store->slots[i].stamp < slot->stamp) slot = &geometry_store->slots[i];
+        }
+
+        snprintf(slot->class, GEOMETRY_NAME, "%.*s", GEOMETRY_NAME - 1, window->class);
+        snprintf(slot->instance, GEOMETRY_NAME, "%.*s", GEOMETRY_NAME - 1, window->instance);
+    }
+
+    slot->x = (int) window->geometry.x - (int) window->monitor->geometry.x;
+    slot->y = (int) window->geometry.y - (int) window->monitor->geometry.y;
+    slot->w = window->geometry.w;
+    slot->h = window->geometry.h;
+    slot->stamp = ++geometry_store->clock;
+
+    if(!timer_pending(&geometry_timer)) schedule(&geometry_timer, GEOMETRY_SYNC);
+}
+
+// Applies the remembered geometry, clamped to the window's monitor.
+bool
+recall_geometry(struct window *window) {
+    struct geometry_slot *slot = find_geometry(window);
+    const struct geometry *area = &window->monitor->geometry;
+
+    // a damaged slot with an empty size is a miss, X rejects a zero size
+    if(!slot || !slot->w || !slot->h) return false;
+
+    slot->stamp = ++geometry_store->clock;
+
+    unsigned w = MIN(slot->w, area->w), h = MIN(slot->h, area->h);
+    apply_size_hints(window, &w, &h);
+
+    int x = MIN(MAX(slot->x, 0), (int) area->w - (int) w);
+    int y = MIN(MAX(slot->y, 0), (int) area->h - (int) h);
+
+    window->geometry = (struct geometry) { area->x + MAX(x, 0), area->y + MAX(y, 0), w, h };
+    move_resize(window, &window->geometry);
+
+    debug("recalled geometry for `%s': %ux%u+%u+%u", window->class, w, h, window->geometry.x, window->geometry.y);
+
+    return true;
+}
+
+void
+float_window(struct window *window) {
+    if(window->floating) return;
+
+    p("floating window 0x%08x -> `%s'", window->id, window->class);
+
+    set_floating(window, true);
+    raise_window(window);
+    update_border_color(window);
+}
+
+void
+toggle_floating(struct window *window) {
+    if(window->floating) {
+        set_floating(window, false);
+        restack();
+    } else  {
+        set_floating(window, true);
+        place_window(window);
+        raise_window(window);
+    }
+
+    update_border_color(window);
+}
+
+void
+send_configure_notify(struct window *window) {
+    xcb_configure_notify_event_t config = {
+        .response_type = XCB_CONFIGURE_NOTIFY,
+        .event = window->id,
+        .window = window->id,
+        .above_sibling = XCB_NONE,
+        .x = window->geometry.x,
+        .y = window->geometry.y,
+        .width = window->geometry.w,
+        .height = window->geometry.h,
+        .border_width = window->monitor->border_width,
+        .override_redirect = false
+    };
+
+    xcb_send_event(connection, false, window->id, XCB_EVENT_MASK_STRUCTURE_NOTIFY,
+        (const char *) &config);
+
+    window->pending_notify = false;
+}
+
+// A tile behind its monitor's fullscreen window.
+unsigned
+obscured(const struct window *window) {
+    return !window->floating && window->monitor->fullscreen && window->monitor->fullscreen != window;
+}
+
+void
+suspend_tile(struct window *window) {
+    window->suspended = true;
+
+    if(fullscreen_hide && !window->hidden) {
+        window->hidden = true;
+        window->ignore_unmap += 1;
+        xcb_unmap_window(connection, window->id);
+        layout_changed = true;
+    }
+}
+
+void
+suspend_tiles(struct monitor *monitor) {
+    struct window *window;
+
+    each_seq_entry(window, &monitor->tiles, position) {
+        if(window == monitor->fullscreen) continue;
+
+        suspend_tile(window);
     }
+}
+
+void
+resume_tiles(struct monitor *monitor) {
+    struct window *window;
+
+    each_seq_entry(window, &monitor->tiles, position) {
+        if(!window->suspended) continue;
 
-    if(curmon->root_count > curmon->window_count) {
-        curmon->root_count = curmon->window_count;
+        window->suspended = false;
+
+        if(window->hidden) {
+            window->hidden = false;
+            xcb_map_window(connection, window->id);
+            layout_changed = true;
+        }
+
+        if(window->pending_notify && !monitor->dirty) {
+            send_configure_notify(window);
+        }
     }
+}
+
+void
+toggle_fullscreen(struct window *window) {
+    struct monitor *monitor = window->monitor;
 
-    if(monitor->window_count > 0) {
-        focus(window_node(node_prev(&monitor->curwin->node, &monitor->windows)));
+    if(window->fullscreen) {
+        p("unset fullscreen");
+        window->fullscreen = false;
+        monitor->fullscreen = NULL;
+        xcb_atom_t atoms[] = { XCB_NONE };
+        xcb_ewmh_set_wm_state(ewmh, window->id, LENGTH(atoms), atoms);
+        resume_tiles(monitor);
+        restack();
+        if(monitor->dirty) {
+            arrange(monitor);
+            if(!window->floating) return;
+        }
+        if(window->floating || seq_size(&monitor->tiles) > 1) {
+            set_border_width(window, monitor->border_width);
+        }
+        move_resize(window, &window->geometry);
     } else {
-        curmon->curwin = NULL; // FIXME
-        focus(NULL);
+        if(monitor->fullscreen) {
+            toggle_fullscreen(monitor->fullscreen);
+        }
+
+        p("set fullscreen");
+        window->fullscreen = true;
+        monitor->fullscreen = window;
+        xcb_atom_t atoms[] = { ewmh->_NET_WM_STATE_FULLSCREEN };
+        xcb_ewmh_set_wm_state(ewmh, window->id, LENGTH(atoms), atoms);
+        set_border_width(window, 0);
+        move_resize(window, &monitor->geometry);
+        raise_window(window);
+        suspend_tiles(monitor);
+    }
+}
+
+// Like arranging, deferred windows are listed once when the batch ends, so
+// removing every window at exit doesn't rebuild the list for each one.
+void
+update_client_list(void) {
+    struct monitor *monitor;
+    struct window *window;
+    unsigned n = 0;
+
+    if(batch || deferring) {
+        client_list_changed = true;
+        return;
+    }
+
+    client_list_changed = false;
+
+    each_node_entry(monitor, &monitors, node)
+        each_node_entry(window, &monitor->windows, node)
+            n++;
+
+    if(!n) {
+        xcb_ewmh_set_client_list(ewmh, default_screen, 0, NULL);
+        return;
+    }
+
+    xcb_window_t windows[n];
+    unsigned i = 0;
+
+    each_node_entry(monitor, &monitors, node)
+        each_node_entry(window, &monitor->windows, node)
+            windows[i++] = window->id;
+
+    xcb_ewmh_set_client_list(ewmh, default_screen, n, windows);
+}
+
+void
+sync_create_alarm(struct window *, xcb_sync_counter_t);
+
+void
+sync_setup_window(struct window *window, xcb_get_property_cookie_t protocols_cookie, xcb_get_property_cookie_t counter_cookie) {
+    xcb_icccm_get_wm_protocols_reply_t protocols;
+    uint64_t counter = 0;
+    unsigned supported = false;
+
+    if(xcb_icccm_get_wm_protocols_reply(connection, protocols_cookie, &protocols, NULL)) {
+        for(unsigned i = 0; i < protocols.atoms_len; i++) {
+            if(protocols.atoms[i] == ewmh->_NET_WM_SYNC_REQUEST) {
+                supported = true;
+            } else if(protocols.atoms[i] == ewmh->_NET_WM_PING) {
+                window->can_ping = true;
+            }
+        }
+
+        xcb_icccm_get_wm_protocols_reply_wipe(&protocols);
+    }
+
+    if(!xcb_ewmh_get_wm_sync_request_counter_reply(ewmh, counter_cookie, &counter, NULL)) {
+        counter = 0;
+    }
+
+    if(!supported) return;
+
+    sync_create_alarm(window, counter);
+}
+
+void
+sync_create_alarm(struct window *window, xcb_sync_counter_t counter) {
+    if(!counter || !sync_event_base) return;
+
+    xcb_sync_create_alarm_value_list_t alarm = {
+        .counter = counter,
+        .valueType = XCB_SYNC_VALUETYPE_ABSOLUTE,
+        .value = { 0, 0 },
+        .testType = XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON,
+        .delta = { 0, 1 },
+        .events = true,
+    };
+
+    window->sync.counter = counter;
+    window->sync.alarm = xcb_generate_id(connection);
+
+    xcb_sync_create_alarm_aux(connection, window->sync.alarm,
+        XCB_SYNC_CA_COUNTER|XCB_SYNC_CA_VALUE_TYPE|XCB_SYNC_CA_VALUE|
+        XCB_SYNC_CA_TEST_TYPE|XCB_SYNC_CA_DELTA|XCB_SYNC_CA_EVENTS, &alarm);
+
+    p("sync counter 0x%08x for 0x%08x", window->sync.counter, window->id);
+}
+
+bool
+update_size_hints(struct window *window, xcb_get_property_cookie_t cookie) {
+    struct hints hints = { 0 };
+    xcb_size_hints_t size;
+
+    if(xcb_icccm_get_wm_normal_hints_reply(connection, cookie, &size, NULL)) {
+        if(size.flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE) {
+            hints.base_w = size.base_width;
+            hints.base_h = size.base_height;
+        } else if(size.flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE) {
+            hints.base_w = size.min_width;
+            hints.base_h = size.min_height;
+        }
+
+        if(size.flags & XCB_ICCCM_SIZE_HINT_P_MIN_SIZE) {
+            hints.min_w = size.min_width;
+            hints.min_h = size.min_height;
+        } else if(size.flags & XCB_ICCCM_SIZE_HINT_BASE_SIZE) {
+            hints.min_w = size.base_width;
+            hints.min_h = size.base_height;
+        }
+
+        if(size.flags & XCB_ICCCM_SIZE_HINT_P_MAX_SIZE) {
+            hints.max_w = size.max_width;
+            hints.max_h = size.max_height;
+        }
+
+        if(size.flags & XCB_ICCCM_SIZE_HINT_P_RESIZE_INC) {
+            hints.inc_w = size.width_inc;
+            hints.inc_h = size.height_inc;
+        }
+    }
+
+    if(!memcmp(&window->hints, &hints, sizeof(hints))) return false;
+
+    window->hints = hints;
+
+    return true;
+}
+
+void
+copy_string(char *dest, const char *src, unsigned length, unsigned size) {
+    length = MIN(length, size - 1);
+    memcpy(dest, src, length);
+    dest[length] = 0;
+}
+
+bool
+update_class(struct window *window, xcb_get_property_cookie_t cookie) {
+    xcb_icccm_get_wm_class_reply_t class;
+
+    if(!xcb_icccm_get_wm_class_reply(connection, cookie, &class, NULL)) return false;
+
+    copy_string(window->class, class.class_name, strlen(class.class_name), sizeof(window->class));
+    copy_string(window->instance, class.instance_name, strlen(class.instance_name), sizeof(window->instance));
+    xcb_icccm_get_wm_class_reply_wipe(&class);
+
+    return true;
+}
+
+// _NET_WM_NAME wins, WM_NAME is the title of clients that only speak ICCCM.
+bool
+update_title(struct window *window, xcb_get_property_cookie_t cookie) {
+    xcb_ewmh_get_utf8_strings_reply_t name;
+    xcb_icccm_get_text_property_reply_t legacy;
+
+    if(xcb_ewmh_get_wm_name_reply(ewmh, cookie, &name, NULL)) {
+        xcb_discard_reply(connection, window->properties.legacy_name.sequence);
+        copy_string(window->title, name.strings, name.strings_len, sizeof(window->title));
+        xcb_ewmh_get_utf8_strings_reply_wipe(&name);
+        return true;
+    }
+
+    if(!xcb_icccm_get_wm_name_reply(connection, window->properties.legacy_name, &legacy, NULL)) {
+        window->title[0] = 0;
+        return false;
+    }
+
+    copy_string(window->title, legacy.name, legacy.name_len, sizeof(window->title));
+    xcb_icccm_get_text_property_reply_wipe(&legacy);
+
+    return true;
+}
+
+bool
+update_wm_hints(struct window *window, xcb_get_property_cookie_t cookie) {
+    xcb_icccm_wm_hints_t hints;
+    unsigned urgent = false;
+
+    if(xcb_icccm_get_wm_hints_reply(connection, cookie, &hints, NULL)) {
+        urgent = (hints.flags & XCB_ICCCM_WM_HINT_X_URGENCY) != 0;
+    }
+
+    if(window->urgent_hint == urgent) return false;
+
+    window->urgent_hint = urgent;
+
+    return true;
+}
+
+bool
+update_state(struct window *window, xcb_get_property_cookie_t cookie) {
+    xcb_ewmh_get_atoms_reply_t atoms;
+    unsigned state = 0;
+
+    if(xcb_ewmh_get_wm_state_reply(ewmh, cookie, &atoms, NULL)) {
+        for(unsigned i = 0; i < atoms.atoms_len; i++) {
+            xcb_atom_t atom = atoms.atoms[i];
+            if(atom == ewmh->_NET_WM_STATE_FULLSCREEN) state |= STATE_FULLSCREEN;
+            else if(atom == ewmh->_NET_WM_STATE_ABOVE) state |= STATE_ABOVE;
+            else if(atom == ewmh->_NET_WM_STATE_DEMANDS_ATTENTION) state |= STATE_ATTENTION;
+        }
+
+        xcb_ewmh_get_atoms_reply_wipe(&atoms);
+    }
+
+    if(window->state == state) return false;
+
+    window->state = state;
+
+    return true;
+}
+
+enum property
+atom_property(xcb_atom_t atom) {
+    if(atom == XCB_ATOM_WM_CLASS) return PROPERTY_CLASS;
+    if(atom == ewmh->_NET_WM_NAME) return PROPERTY_NAME;
+    if(atom == XCB_ATOM_WM_NAME) return PROPERTY_NAME;
+    if(atom == XCB_ATOM_WM_HINTS) return PROPERTY_HINTS;
+    if(atom == XCB_ATOM_WM_NORMAL_HINTS) return PROPERTY_NORMAL_HINTS;
+    if(atom == ewmh->_NET_WM_STATE) return PROPERTY_STATE;
+    return PROPERTY_MAX;
+}
+
+// Sends the request for a stale property without waiting for the reply.
+void
+request_property(struct window *window, enum property property) {
+    struct properties *properties = &window->properties;
+    unsigned bit = 1 << property;
+
+    if(!(properties->stale & bit) || (properties->pending & bit)) return;
+
+    xcb_get_property_cookie_t *cookie = &properties->cookies[property];
+
+    switch(property) {
+        case PROPERTY_CLASS:        *cookie = xcb_icccm_get_wm_class_unchecked(connection, window->id); break;
+        case PROPERTY_NAME:
+            *cookie = xcb_ewmh_get_wm_name_unchecked(ewmh, window->id);
+            properties->legacy_name = xcb_icccm_get_wm_name_unchecked(connection, window->id);
+            break;
+        case PROPERTY_HINTS:        *cookie = xcb_icccm_get_wm_hints_unchecked(connection, window->id); break;
+        case PROPERTY_NORMAL_HINTS: *cookie = xcb_icccm_get_wm_normal_hints_unchecked(connection, window->id); break;
+        case PROPERTY_STATE:        *cookie = xcb_ewmh_get_wm_state_unchecked(ewmh, window->id); break;
+        default: return;
+    }
+
+    properties->pending |= bit;
+}
+
+// Brings a property up to date, returns whether its value changed.
+bool
+update_property(struct window *window, enum property property) {
+    struct properties *properties = &window->properties;
+    unsigned bit = 1 << property;
+
+    if(!(properties->stale & bit)) return false;
+
+    request_property(window, property);
+
+    xcb_get_property_cookie_t cookie = properties->cookies[property];
+
+    properties->stale &= ~bit;
+    properties->pending &= ~bit;
+
+    switch(property) {
+        case PROPERTY_CLASS:        return update_class(window, cookie);
+        case PROPERTY_NAME:         return update_title(window, cookie);
+        case PROPERTY_HINTS:        return update_wm_hints(window, cookie);
+        case PROPERTY_NORMAL_HINTS: return update_size_hints(window, cookie);
+        case PROPERTY_STATE:        return update_state(window, cookie);
+        default:                    return false;
+    }
+}
+
+void
+discard_property(struct window *window, enum property property) {
+    struct properties *properties = &window->properties;
+
+    if(!(properties->pending & (1 << property))) return;
+
+    xcb_discard_reply(connection, properties->cookies[property].sequence);
+
+    if(property == PROPERTY_NAME) {
+        xcb_discard_reply(connection, properties->legacy_name.sequence);
+    }
+
+    properties->pending &= ~(1 << property);
+}
+
+void
+discard_properties(struct window *window) {
+    struct properties *properties = &window->properties;
+
+    for(unsigned i = 0; i < PROPERTY_MAX; i++) {
+        discard_property(window, i);
+    }
+
+    if(properties->queued) {
+        node_remove(&window->property_node);
+        properties->queued = false;
+    }
+}
+
+const char *
+window_class(struct window *window) {
+    update_property(window, PROPERTY_CLASS);
+    return window->class;
+}
+
+const char *
+window_title(struct window *window) {
+    update_property(window, PROPERTY_NAME);
+    return window->title;
+}
+
+bool
+match_rule(const struct rule *rule, struct window *window) {
+    window_class(window);
+    return streq(rule->name, window->class) || streq(rule->name, window->instance);
+}
+
+void
+update_urgency(struct window *window) {
+    unsigned urgent = window->urgent_hint || (window->state & STATE_ATTENTION);
+
+    if(window->urgent == urgent) return;
+
+    window->urgent = urgent;
+    update_border_color(window);
+}
+
+// Sends the request now and collects the reply in update_properties(), once
+// the event queue has drained.
+void
+queue_property(struct window *window, enum property property) {
+    struct properties *properties = &window->properties;
+
+    request_property(window, property);
+
+    if(!properties->queued) {
+        node_append(&window->property_node, &property_updates);
+        properties->queued = true;
+    }
+}
+
+// Everything but the title feeds borders, rules or the layout and is fetched
+// right away; the title is only marked stale until something reads it.
+void
+property_changed(struct window *window, xcb_atom_t atom) {
+    enum property property = atom_property(atom);
+
+    if(property == PROPERTY_MAX) return;
+
+    discard_property(window, property);
+    window->properties.stale |= 1 << property;
+
+    if(property != PROPERTY_NAME) queue_property(window, property);
+}
+
+// Brings every stale title up to date in one pass, all requests sent before
+// the first reply is read.
+void
+update_titles(void) {
+    struct monitor *monitor;
+    struct window *window;
+
+    each_node_entry(monitor, &monitors, node) {
+        each_node_entry(window, &monitor->windows, node) {
+            request_property(window, PROPERTY_NAME);
+        }
+    }
+
+    each_node_entry(monitor, &monitors, node) {
+        each_node_entry(window, &monitor->windows, node) {
+            update_property(window, PROPERTY_NAME);
+        }
+    }
+}
+
+void
+update_properties(void) {
+    struct window *window, *w;
+
+    each_node_entry_safe(window, w, &property_updates, property_node) {
+        node_remove(&window->property_node);
+        window->properties.queued = false;
+
+        update_property(window, PROPERTY_CLASS);
+
+        unsigned urgency = update_property(window, PROPERTY_HINTS);
+        urgency |= update_property(window, PROPERTY_STATE);
+
+        if(urgency) {
+            update_urgency(window);
+        }
+
+        if(update_property(window, PROPERTY_NORMAL_HINTS)) {
+            p("size hints changed for 0x%08x", window->id);
+            if(!window->floating) arrange(window->monitor);
+        }
+    }
+
+    flush();
+}
+
+void
+center_window(struct window *window, const struct geometry *parent) {
+    int x = (int) parent->x + ((int) parent->w - (int) window->geometry.w) / 2;
+    int y = (int) parent->y + ((int) parent->h - (int) window->geometry.h) / 2;
+
+    window->geometry.x = MAX(x, (int) window->monitor->geometry.x);
+    window->geometry.y = MAX(y, (int) window->monitor->geometry.y);
+
+    move(window, window->geometry.x, window->geometry.y);
+}
+
+void
+trace_write(enum trace_type type, const void *data, unsigned length) {
+    struct trace_record record = { now() - trace_start, type, length, 0 };
+
+    if(fwrite(&record, sizeof(record), 1, trace_file) != 1 || fwrite(data, 1, length, trace_file) != length) {
+        p("warning: trace write failed, stopping trace");
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+void
+trace_command(const struct command *command) {
+    char text[BUFSIZ];
+    unsigned o = 0;
+
+    // a command that doesn't fit is recorded cut short rather than dropped
+    for(unsigned i = 0; i < command->argc && o < sizeof(text); i++) {
+        o += snprintf(text + o, sizeof(text) - o, i ? " %s" : "%s", command->argv[i]);
+    }
+
+    trace_write(TRACE_COMMAND, text, MIN(o, sizeof(text) - 1));
+}
+
+void
+trace_window(const struct window *window, const struct geometry *requested) {
+    struct trace_window record = {
+        .id = window->id,
+        .transient = window->transient ? window->transient->id : XCB_NONE,
+        .x = requested->x, .y = requested->y,
+        .w = requested->w, .h = requested->h,
+        .floating = window->floating
+    };
+
+    snprintf(record.class, sizeof(record.class), "%.*s", TRACE_NAME - 1, window->class);
+    snprintf(record.instance, sizeof(record.instance), "%.*s", TRACE_NAME - 1, window->instance);
+
+    trace_write(TRACE_WINDOW, &record, sizeof(record));
+}
+
+void
+trace_stop(void) {
+    if(!trace_file) return;
+
+    p("trace stopped: %s", trace_path);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+bool
+trace_open(const char *path, const char *mode) {
+    trace_stop();
+
+    if(!(trace_file = fopen(path, mode))) {
+        p("warning: could not open trace %s", path);
+        return false;
+    }
+
+    // large buffer so tracing costs a write(2) every few thousand events
+    setvbuf(trace_file, NULL, _IOFBF, 1 << 16);
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+
+    return true;
+}
+
+// Windows managed before the trace began are described with their current
+// geometry, so the replay knows them. Parents go before their transients.
+bool
+trace_begin(const char *path) {
+    if(!trace_open(path, "we")) return false;
+
+    trace_start = now();
+
+    struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, trace_start };
+    fwrite(&header, sizeof(header), 1, trace_file);
+
+    struct monitor *monitor;
+    struct window *window;
+
+    for(unsigned transient = 0; transient < 2; transient++) {
+        each_node_entry(monitor, &monitors, node) {
+            each_node_entry(window, &monitor->windows, node) {
+                if(trace_file && !window->transient == !transient) trace_window(window, &window->geometry);
+            }
+        }
+    }
+
+    p("tracing to %s", path);
+
+    return true;
+}
+
+// Continues a trace carried over a restart, keeping its header and start
+// time so the records before and after line up.
+bool
+trace_resume(const char *path) {
+    if(!trace_open(path, "a+e")) return false;
+
+    struct trace_header header;
+
+    if(fread(&header, sizeof(header), 1, trace_file) != 1 ||
+       header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        p("warning: not resuming trace %s", path);
+        fclose(trace_file);
+        trace_file = NULL;
+        return false;
+    }
+
+    // a stream switching from reading to writing has to be repositioned
+    fseek(trace_file, 0, SEEK_END);
+    trace_start = header.start;
+
+    p("tracing to %s, resumed", path);
+
+    return true;
+}
+
+void
+ping_expire(struct timer *timer) {
+    struct window *window = timer_entry(timer, struct window, ping_timer);
+
+    p("window 0x%08x -> `%s' not responding, killing client", window->id, window->class);
+    xcb_kill_client(connection, window->id);
+}
+
+void
+init_window(struct window *window, xcb_window_t id) {
+    window->id = id;
+    window->properties.stale = PROPERTY_ALL;
+    window->properties.pending = 0;
+    window->properties.queued = false;
+    window->class[0] = 0;
+    window->instance[0] = 0;
+    window->title[0] = 0;
+    window->hints = (struct hints) { 0 };
+    window->state = 0;
+    window->urgent_hint = false;
+    window->transient = NULL;
+    window->floating = false;
+    window->fullscreen = false;
+    window->urgent = false;
+    window->has_color = false;
+    window->suspended = false;
+    window->hidden = false;
+    window->pending_notify = false;
+    window->ignore_unmap = 0;
+    window->raised = ++stack_clock;
+    window->stacked = false;
+    window->sync = (struct sync) { 0 };
+    window->can_ping = false;
+
+    timer_init(&window->sync.timer, sync_expire);
+    timer_init(&window->ping_timer, ping_expire);
+
+    node_init(&window->sync_node);
+    node_init(&window->transients);
+    node_init(&window->transient_node);
+    node_append(&window->hash_node, window_bucket(id));
+    node_append(&window->stack_node, &stack);
+}
+
+// Selected before any property is read, so a change made after a read is
+// always followed by a notify.
+void
+select_window_events(xcb_window_t id) {
+    unsigned values[] = {
+        XCB_EVENT_MASK_ENTER_WINDOW |
+        XCB_EVENT_MASK_FOCUS_CHANGE |
+        XCB_EVENT_MASK_PROPERTY_CHANGE
+    };
+    xcb_change_window_attributes(connection, id, XCB_CW_EVENT_MASK, values);
+}
+
+struct window *
+add_window(struct monitor *monitor, xcb_window_t id) {
+    struct window *window = malloc(sizeof(*window));
+
+    init_window(window, id);
+    select_window_events(id);
+
+    // Class picks the rule, normal hints and state shape the first layout;
+    // urgency is not needed before the window is managed. The title stays
+    // stale until something reads it.
+    request_property(window, PROPERTY_CLASS);
+    request_property(window, PROPERTY_NORMAL_HINTS);
+    request_property(window, PROPERTY_STATE);
+    queue_property(window, PROPERTY_HINTS);
+
+    xcb_get_property_cookie_t transient_cookie = xcb_icccm_get_wm_transient_for_unchecked(connection, id);
+    xcb_get_property_cookie_t type_cookie = xcb_ewmh_get_wm_window_type(ewmh, id);
+    xcb_get_geometry_cookie_t geometry_cookie = xcb_get_geometry(connection, id);
+    xcb_get_property_cookie_t protocols_cookie = xcb_icccm_get_wm_protocols(connection, id, wm_protocols_atom);
+    xcb_get_property_cookie_t counter_cookie = xcb_ewmh_get_wm_sync_request_counter(ewmh, id);
+
+    update_property(window, PROPERTY_CLASS);
+
+    xcb_window_t transient = XCB_NONE;
+
+    if(xcb_icccm_get_wm_transient_for_reply(connection, transient_cookie, &transient, NULL)) {
+        if(transient != id && (window->transient = find_window(transient))) {
+            monitor = window->transient->monitor;
+            node_append(&window->transient_node, &window->transient->transients);
+        }
+    }
+
+    xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(connection, geometry_cookie, NULL);
+
+    if(geom) {
+        window->geometry = (struct geometry) { geom->x, geom->y, geom->width, geom->height };
+        window->shadow.border_width = geom->border_width;
+        free(geom);
+    } else {
+        window->geometry = monitor->geometry;
+        window->shadow.border_width = 0;
+    }
+
+    window->shadow.geometry = window->geometry;
+    window->shadow.border_color = ~0u;
+    window->shadow.mapped = false;
+
+    struct geometry requested = window->geometry;
+
+    sync_setup_window(window, protocols_cookie, counter_cookie);
+    update_property(window, PROPERTY_NORMAL_HINTS);
+    update_property(window, PROPERTY_STATE);
+
+    window->urgent = (window->state & STATE_ATTENTION) != 0;
+
+    window->monitor = monitor;
+    monitor->window_count += 1;
+
+    node_append(&window->node, &monitor->windows);
+
+    // The stack cache has the new window on top, but mapping does not raise:
+    // a window that was withdrawn and mapped again keeps its old position.
+    stack_top(window);
+
+    if(monitor->curwin && !monitor->curwin->floating) {
+        seq_insert_at(&monitor->tiles, &window->position, seq_index(&monitor->curwin->position) + 1);
+    } else {
+        seq_insert_at(&monitor->tiles, &window->position, 0);
+    }
+
+    p("add window 0x%08x -> `%s', monitor %d", id, window->class, monitor->id);
+
+    if(window->transient) {
+        p("window is transient for 0x%08x -> `%s'", window->transient->id, window->transient->class);
+        float_window(window);
+        center_window(window, &window->transient->geometry);
+    }
+
+    xcb_ewmh_get_atoms_reply_t atoms;
+
+    if(xcb_ewmh_get_wm_window_type_reply(ewmh, type_cookie, &atoms, NULL)) {
+        for(unsigned i = 0; i < atoms.atoms_len; i++) {
+            xcb_atom_t atom = atoms.atoms[i];
+            if(atom == ewmh->_NET_WM_WINDOW_TYPE_DIALOG) {
+                p("window-type dialog");
+                float_window(window);
+                break;
+            }
+        }
+
+        xcb_ewmh_get_atoms_reply_wipe(&atoms);
+    }
+
+    struct rule *rule;
+
+    each_node_entry(rule, &rules, node) {
+        if(match_rule(rule, window)) {
+            if(rule->has_color) {
+                window->has_color = true;
+                window->color = rule->color;
+            }
+
+            if(rule->floating) {
+                float_window(window);
+            }
+
+            if(rule->fullscreen && !window->fullscreen) {
+                toggle_fullscreen(window);
+            }
+        }
+    }
+
+    if((window->state & STATE_FULLSCREEN) && !window->fullscreen) {
+        toggle_fullscreen(window);
+    }
+
+    set_border_width(window, monitor->border_width);
+
+    if(window->floating && !window->transient && !window->fullscreen && !recall_geometry(window)) {
+        place_window(window);
+    }
+    update_border_color(window);
+
+    update_client_list(); // FIXME
+
+    if(trace_file) {
+        trace_window(window, &requested);
+    }
+
+    return window;
+}
+
+void
+send_window(struct window *window, struct monitor *monitor) {
+    struct monitor *from = window->monitor;
+
+    if(from == monitor) return;
+
+    p("send window 0x%08x -> monitor %d", window->id, monitor->id);
+
+    if(window->fullscreen) {
+        toggle_fullscreen(window);
+    }
+
+    // a tile hidden here and behind a fullscreen window there stays unmapped
+    unsigned behind = !window->floating && monitor->fullscreen;
+
+    if(window->hidden && !(behind && fullscreen_hide)) {
+        window->hidden = false;
+        xcb_map_window(connection, window->id);
+    }
+
+    window->suspended = false;
+
+    if(from->curwin == window) {
+        from->curwin = from->window_count > 1 ? step_window(window, -1) : NULL;
+    }
+
+    seq_remove(window_sequence(window), &window->position);
+    node_remove(&window->node);
+    from->window_count -= 1;
+
+    window->monitor = monitor;
+    monitor->window_count += 1;
+    node_append(&window->node, &monitor->windows);
+    seq_append(window_sequence(window), &window->position);
+
+    if(behind) suspend_tile(window);
+
+    if(window->floating) {
+        window->geometry.x += monitor->geometry.x - from->geometry.x;
+        window->geometry.y += monitor->geometry.y - from->geometry.y;
+        move(window, window->geometry.x, window->geometry.y);
+    }
+
+    struct window *child;
+    each_node_entry(child, &window->transients, transient_node) {
+        send_window(child, monitor);
+    }
+}
+
+unsigned
+remove_window(struct window *window) {
+    struct monitor *monitor = window->monitor;
+
+    p("remove window 0x%08x -> `%s', monitor %d", window->id, window->class, monitor->id);
+
+    remember_geometry(window);
+
+    struct window *next = NULL;
+
+    if(monitor->curwin == window && monitor->window_count > 1) {
+        next = step_window(window, -1);
+    }
+
+    monitor->window_count -= 1;
+
+    node_remove(&window->node);
+    node_remove(&window->hash_node);
+    node_remove(&window->stack_node);
+    discard_properties(window);
+
+    if(window->sync.waiting) {
+        node_remove(&window->sync_node);
+    }
+
+    // the counter may be gone with the client, so an error is expected
+    // and dropped instead of reported
+    if(window->sync.alarm) {
+        xcb_discard_reply(connection, xcb_sync_destroy_alarm_checked(connection, window->sync.alarm).sequence);
+    }
+
+    unschedule(&window->sync.timer);
+    unschedule(&window->ping_timer);
+
+    node_remove(&window->transient_node);
+    seq_remove(window_sequence(window), &window->position);
+
+    struct window *child, *c;
+    each_node_entry_safe(child, c, &window->transients, transient_node) {
+        child->transient = NULL;
+        node_remove(&child->transient_node);
+        node_init(&child->transient_node);
+    }
+
+    if(hover == window) {
+        hover = NULL;
+        unschedule(&focus_timer);
+    }
+
+    if(pointer->window == window) {
+        pointer->window = NULL;
+        pointer->action = ACTION_NONE;
+    }
+
+    if(window->fullscreen) {
+        monitor->fullscreen = NULL;
+        resume_tiles(monitor);
+    }
+
+    if(monitor->root_count > monitor->window_count) {
+        monitor->root_count = MAX(monitor->window_count, 1);
+    }
+
+    if(monitor->curwin == window) {
+        monitor->curwin = NULL;
+
+        if(monitor == curmon) {
+            focus(next);
+        } else {
+            monitor->curwin = next;
+        }
+    }
+
+    if(!window->floating || monitor->dirty) {
+        arrange(monitor);
+    }
+
+    update_client_list();
+
+    free(window);
+
+    return true;
+}
+
+const unsigned root_event_mask =
+    XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+    XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY |
+    XCB_EVENT_MASK_ENTER_WINDOW |
+    XCB_EVENT_MASK_LEAVE_WINDOW;
+
+// Pointer motion is selected on the root only while the pointer is over no
+// window: motion over a client that does not select it propagates to the
+// root as well.
+void
+root_motion(unsigned enable) {
+    static unsigned selected = false;
+
+    if(enable == selected) return;
+
+    unsigned values[] = { root_event_mask | (enable ? XCB_EVENT_MASK_POINTER_MOTION : 0) };
+    xcb_change_window_attributes(connection, root, XCB_CW_EVENT_MASK, values);
+    selected = enable;
+}
+
+void
+substructure(void) {
+    unsigned values[] = { root_event_mask };
+    xcb_void_cookie_t cookie = xcb_change_window_attributes_checked(connection, root, XCB_CW_EVENT_MASK, values);
+
+    if(xcb_request_check(connection, cookie)) {
+        d("error: could not set substructure_redirect");
+    }
+}
+
+void
+reparent(void) {
+    xcb_query_tree_reply_t *reply = xcb_query_tree_reply(connection, xcb_query_tree(connection, root), NULL);
+    xcb_window_t *c = xcb_query_tree_children(reply);
+    unsigned n = xcb_query_tree_children_length(reply);
+    struct window *window = NULL;
+
+    for(unsigned i = 0; i < n; i++) {
+        if(find_window(c[i])) continue;
+
+        xcb_get_window_attributes_reply_t *attr = get_attributes(c[i]);
+        unsigned override_redirect = attr->override_redirect;
+        unsigned viewable = attr->map_state == XCB_MAP_STATE_VIEWABLE;
+
+        free(attr);
+
+        if(override_redirect) {
+            p("ignoring window 0x%08x -> override_redirect", c[i]);
+            continue;
+        }
+
+        if(!viewable) {
+            p("ignoring window 0x%08x -> not viewable", c[i]);
+            continue;
+        }
+
+        xcb_get_geometry_reply_t *geom = get_geometry(c[i]);
+        struct monitor *monitor = get_monitor_from_point(geom->x + (geom->width / 2), geom->y + (geom->height / 2));
+        free(geom);
+        window = add_window(monitor ? monitor : curmon, c[i]);
+        window->shadow.mapped = true;
+
+        if(obscured(window)) suspend_tile(window);
+    }
+
+    update_properties();
+
+    if(window) {
+        arrange(window->monitor);
+        focus(window->suspended ? window->monitor->fullscreen : window);
+    }
+
+    free(reply);
+}
+
+struct output {
+    xcb_randr_output_t  id;
+    struct geometry     geometry;
+};
+
+// Every connected output driven by a crtc, clones collapsed into one.
+unsigned
+query_outputs(struct output *outputs, unsigned max) {
+    xcb_randr_get_screen_resources_current_reply_t *resources = xcb_randr_get_screen_resources_current_reply(connection,
+        xcb_randr_get_screen_resources_current(connection, root), NULL);
+
+    if(!resources) return 0;
+
+    xcb_randr_output_t *ids = xcb_randr_get_screen_resources_current_outputs(resources);
+    unsigned len = xcb_randr_get_screen_resources_current_outputs_length(resources);
+    xcb_timestamp_t timestamp = resources->config_timestamp;
+    xcb_randr_get_output_info_cookie_t output_cookies[len];
+    xcb_randr_get_crtc_info_cookie_t crtc_cookies[len];
+    xcb_randr_crtc_t crtcs[len];
+
+    for(unsigned i = 0; i < len; i++) {
+        output_cookies[i] = xcb_randr_get_output_info(connection, ids[i], timestamp);
+    }
+
+    for(unsigned i = 0; i < len; i++) {
+        xcb_randr_get_output_info_reply_t *info = xcb_randr_get_output_info_reply(connection, output_cookies[i], NULL);
+
+        crtcs[i] = XCB_NONE;
+
+        if(info) {
+            if(info->connection == XCB_RANDR_CONNECTION_CONNECTED) crtcs[i] = info->crtc;
+            free(info);
+        }
+
+        if(crtcs[i] != XCB_NONE) {
+            crtc_cookies[i] = xcb_randr_get_crtc_info(connection, crtcs[i], timestamp);
+        }
+    }
+
+    unsigned n = 0;
+
+    for(unsigned i = 0; i < len; i++) {
+        if(crtcs[i] == XCB_NONE) continue;
+
+        xcb_randr_get_crtc_info_reply_t *crtc = xcb_randr_get_crtc_info_reply(connection, crtc_cookies[i], NULL);
+
+        if(!crtc) continue;
+
+        struct geometry geometry = { crtc->x, crtc->y, crtc->width, crtc->height };
+        unsigned clone = !geometry.w || !geometry.h;
+
+        free(crtc);
+
+        for(unsigned j = 0; j < n && !clone; j++) {
+            clone = !memcmp(&outputs[j].geometry, &geometry, sizeof(geometry));
+        }
+
+        if(clone || n == max) continue;
+
+        outputs[n].id = ids[i];
+        outputs[n].geometry = geometry;
+        n++;
+    }
+
+    free(resources);
+
+    return n;
+}
+
+void
+randr_setup(void) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(connection, &xcb_randr_id);
+
+    if(!extension || !extension->present) {
+        p("randr extension not available");
+        return;
+    }
+
+    xcb_randr_query_version_reply_t *reply = xcb_randr_query_version_reply(connection,
+        xcb_randr_query_version(connection, XCB_RANDR_MAJOR_VERSION, XCB_RANDR_MINOR_VERSION), NULL);
+
+    if(!reply) return;
+
+    if(reply->major_version > 1 || reply->minor_version >= 3) {
+        randr_event_base = extension->first_event;
+        xcb_randr_select_input(connection, root,
+            XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+            XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+            XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+    }
+
+    free(reply);
+}
+
+unsigned
+distance(const struct geometry *a, const struct geometry *b) {
+    int dx = ((int) a->x + (int) a->w / 2) - ((int) b->x + (int) b->w / 2);
+    int dy = ((int) a->y + (int) a->h / 2) - ((int) b->y + (int) b->h / 2);
+
+    return abs(dx) + abs(dy);
+}
+
+struct monitor *
+nearest_monitor(const struct geometry *geometry, struct monitor **candidates, unsigned n) {
+    struct monitor *nearest = NULL;
+    unsigned best = ~0u;
+
+    for(unsigned i = 0; i < n; i++) {
+        unsigned d = distance(geometry, &candidates[i]->base_geometry);
+
+        if(d < best) {
+            best = d;
+            nearest = candidates[i];
+        }
+    }
+
+    return nearest;
+}
+
+void
+remove_monitor(struct monitor *monitor, struct monitor *target) {
+    p("remove monitor -> %d, windows to %d", monitor->id, target->id);
+
+    while(monitor->window_count) {
+        struct window *window = node_entry(monitor->windows.next, struct window, node);
+
+        while(window->transient && window->transient->monitor == monitor) {
+            window = window->transient;
+        }
+
+        send_window(window, target);
+    }
+
+    node_remove(&monitor->node);
+    unschedule(&monitor->arrange_timer);
+
+    if(curmon == monitor) {
+        curmon = target;
+    }
+
+    free(monitor);
+}
+
+// Matches outputs to existing monitors by output id, then by geometry.
+// Matching monitors keep their windows and layout; only monitors that
+// changed, appeared or took over windows are arranged again.
+void
+reconcile_monitors(void) {
+    struct output outputs[MAXMONITORS];
+    struct monitor *matched[MAXMONITORS] = { NULL };
+    struct monitor *affected[MAXMONITORS];
+    unsigned n = query_outputs(outputs, LENGTH(outputs)), a = 0;
+
+    monitors_changed = false;
+
+    if(!n) return;
+
+    struct monitor *monitor, *m;
+
+    for(unsigned i = 0; i < n; i++) {
+        each_node_entry(monitor, &monitors, node) {
+            if(monitor->output && monitor->output == outputs[i].id) {
+                matched[i] = monitor;
+                break;
+            }
+        }
+    }
+
+    for(unsigned i = 0; i < n; i++) {
+        if(matched[i]) continue;
+
+        each_node_entry(monitor, &monitors, node) {
+            bool taken = false;
+
+            for(unsigned j = 0; j < n; j++) taken |= matched[j] == monitor;
+
+            if(!taken && !memcmp(&monitor->base_geometry, &outputs[i].geometry, sizeof(struct geometry))) {
+                matched[i] = monitor;
+                break;
+            }
+        }
+    }
+
+    for(unsigned i = 0; i < n; i++) {
+        struct geometry *geometry = &outputs[i].geometry;
+
+        if(!(monitor = matched[i])) {
+            monitor = matched[i] = add_monitor(geometry->x, geometry->y, geometry->w, geometry->h);
+            affected[a++] = monitor;
+        } else if(memcmp(&monitor->base_geometry, geometry, sizeof(*geometry))) {
+            p("resize monitor -> %d, %dx%d+%d+%d", monitor->id, geometry->w, geometry->h, geometry->x, geometry->y);
+            monitor->base_geometry = *geometry;
+            resize_monitor(monitor);
+            affected[a++] = monitor;
+        }
+
+        monitor->output = outputs[i].id;
+    }
+
+    each_node_entry_safe(monitor, m, &monitors, node) {
+        bool keep = false;
+
+        for(unsigned i = 0; i < n; i++) keep |= matched[i] == monitor;
+
+        if(keep) continue;
+
+        struct monitor *target = nearest_monitor(&monitor->base_geometry, matched, n);
+
+        remove_monitor(monitor, target);
+
+        for(unsigned i = 0; i < a && target; i++) {
+            if(affected[i] == target) target = NULL;
+        }
+
+        if(target) affected[a++] = target;
+    }
+
+    for(unsigned i = 0; i < a; i++) {
+        arrange(affected[i]);
+        update_border_colors(affected[i]);
+    }
+
+    focus(curmon->curwin);
+    flush();
+}
+
+void
+monitor_setup(void) {
+    struct output outputs[MAXMONITORS];
+    unsigned n = randr_event_base ? query_outputs(outputs, LENGTH(outputs)) : 0;
+
+    if(n) {
+        for(unsigned i = 0; i < n; i++) {
+            struct geometry *geometry = &outputs[i].geometry;
+            add_monitor(geometry->x, geometry->y, geometry->w, geometry->h)->output = outputs[i].id;
+        }
+    } else if(xinerama_is_active()) {
+        xcb_xinerama_query_screens_reply_t *reply = xcb_xinerama_query_screens_reply(connection, xcb_xinerama_query_screens(connection), NULL);
+        xcb_xinerama_screen_info_t *screens = xcb_xinerama_query_screens_screen_info(reply);
+        unsigned n = xcb_xinerama_query_screens_screen_info_length(reply);
+
+        for(unsigned i = 0; i < n; i++) {
+            xcb_xinerama_screen_info_t screen = screens[i];
+            add_monitor(screen.x_org, screen.y_org, screen.width, screen.height);
+        }
+
+        free(reply);
+    } else {
+        add_monitor(0, 0, w, h);
+    }
+}
+
+void
+ewmh_setup(void) {
+    ewmh = (xcb_ewmh_connection_t *) malloc(sizeof(*ewmh));
+    xcb_intern_atom_cookie_t *cookies;
+    cookies = xcb_ewmh_init_atoms(connection, ewmh);
+    xcb_ewmh_init_atoms_replies(ewmh, cookies, NULL);
+
+    xcb_atom_t atoms[] = {
+        ewmh->_NET_SUPPORTED,
+        ewmh->_NET_CLIENT_LIST,
+        ewmh->_NET_NUMBER_OF_DESKTOPS,
+        ewmh->_NET_CURRENT_DESKTOP,
+        ewmh->_NET_ACTIVE_WINDOW,
+//      ewmh->_NET_WM_DESKTOP,
+        ewmh->_NET_WM_WINDOW_TYPE,
+        ewmh->_NET_WM_WINDOW_TYPE_DIALOG,
+        ewmh->_NET_WM_STATE,
+        ewmh->_NET_WM_STATE_FULLSCREEN,
+        ewmh->_NET_WM_SYNC_REQUEST,
+        ewmh->_NET_WM_SYNC_REQUEST_COUNTER,
+    };
+
+    xcb_ewmh_set_supported(ewmh, default_screen, LENGTH(atoms), atoms);
+    xcb_ewmh_set_number_of_desktops(ewmh, default_screen, 1);
+    xcb_ewmh_set_current_desktop(ewmh, default_screen, 0);
+}
+
+void
+sync_setup(void) {
+    const xcb_query_extension_reply_t *extension = xcb_get_extension_data(connection, &xcb_sync_id);
+
+    if(!extension || !extension->present) {
+        p("sync extension not available");
+        return;
+    }
+
+    xcb_sync_initialize_reply_t *reply = xcb_sync_initialize_reply(connection,
+        xcb_sync_initialize(connection, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION), NULL);
+
+    if(reply) {
+        sync_event_base = extension->first_event;
+        free(reply);
+    }
+}
+
+unsigned
+parse_boolean(const char *param, unsigned *data) {
+    if(streq(param, "toggle")) {
+        *data ^= 1;
+    } else if(streq(param, "false") || streq(param, "off")) {
+        *data = false;
+    } else if(streq(param, "true") || streq(param, "on")) {
+        *data = true;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+unsigned
+make_root() {
+    if(seq_size(&curmon->tiles) < 2) return false;
+    if(!curmon->curwin || curmon->curwin->floating) return false;
+    seq_move(&curmon->tiles, &curmon->curwin->position, 0);
+    arrange(curmon);
+    return true;
+}
+
+float
+clamp_root_size(float size) {
+    if(size > ROOT_MAX) return ROOT_MAX;
+    if(size < ROOT_MIN) return ROOT_MIN;
+    return size;
+}
+
+// The upper bound only applies once there are windows to count.
+unsigned
+clamp_root_count(int count) {
+    if(count < 1) return 1;
+    if(curmon->window_count >= 2 && count > (int) curmon->window_count) return curmon->window_count;
+    return count;
+}
+
+// Layout settings are kept with fewer than two windows, so a config loaded
+// before any window is managed still applies; they only take effect once
+// there is something to lay out. Returns false for an invalid argument.
+unsigned
+set_root_size(const char *param) {
+    float cur = curmon->root_size;
+    float size;
+
+    if(sscanf(param, "%f", &size) != 1) return false;
+
+    if(param[0] == '+' || param[0] == '-') {
+        curmon->root_size = clamp_root_size(cur + size);
+    } else {
+        curmon->root_size = clamp_root_size(size);
+    }
+
+    if(curmon->root_size != cur && curmon->window_count >= 2) {
+        arrange_throttled(curmon);
+    }
+
+    return true;
+}
+
+unsigned
+set_root_count(const char *param) {
+    unsigned cur = curmon->root_count;
+    int count;
+
+    if(sscanf(param, "%d", &count) != 1) return false;
+
+    if(param[0] == '+' || param[0] == '-') {
+        curmon->root_count = clamp_root_count((int) cur + count);
+    } else {
+        curmon->root_count = clamp_root_count(count);
+    }
+
+    if(curmon->root_count != cur && curmon->window_count >= 2) {
+        arrange_throttled(curmon);
+    }
+
+    return true;
+}
+
+unsigned
+shift_window(const char *param) {
+    if(!curmon->curwin) return false;
+
+    struct seq *seq = window_sequence(curmon->curwin);
+    int size = seq_size(seq);
+    int index = seq_index(&curmon->curwin->position);
+    int count;
+
+    if(size < 2) return false;
+
+    if(param[0] == '@') {
+        if(sscanf(param + 1, "%d", &count) != 1) return false;
+        if(count < 0 || count >= size) return false;
+    } else {
+        if(sscanf(param, "%d", &count) != 1) return false;
+        count = ((index + count) % size + size) % size;
+    }
+
+    if(count == index) return false;
+
+    seq_move(seq, &curmon->curwin->position, count);
+
+    if(!curmon->curwin->floating) arrange(curmon);
+
+    return true;
+}
+
+unsigned
+select_window(const char *param) {
+    int id;
+
+    if(param[0] == '+' || param[0] == '-') {
+        if(!curmon->curwin) return false;
+        if(!sscanf(param, "%d", &id)) return false;
+
+        focus(step_window(curmon->curwin, id));
+
+        return true;
+    } else if(param[0] == '@') {
+        struct seq_node *tile;
+
+        if(sscanf(param + 1, "%d", &id) != 1 || id < 0) return false;
+        if(!(tile = seq_at(&curmon->tiles, id))) return false;
+
+        focus(window_position(tile));
+
+        return true;
+    } else {
+        if(!sscanf(param, "%x", &id)) return false;
+
+        struct window *window;
+
+        if(curmon->curwin && id == curmon->curwin->id) return false;
+        if(!(window = find_window(id))) return false;
+
+        focus(window);
+
+        return true;
+    }
+}
+
+void
+get_parameter(const char *name, char *response) {
+    if(streq(name, "root-size")) {
+        snprintf(response, BUFSIZ, "%f\n", curmon->root_size);
+    } else if(streq(name, "root-count")) {
+        snprintf(response, BUFSIZ, "%u\n", curmon->root_count);
+    } else if(streq(name, "window-gap")) {
+        snprintf(response, BUFSIZ, "%u\n", curmon->window_gap);
+    } else if(streq(name, "border-width")) {
+        snprintf(response, BUFSIZ, "%u\n", curmon->border_width);
+    } else if(streq(name, "fullscreen")) {
+        snprintf(response, BUFSIZ, "%s\n", curmon->fullscreen ? "true" : "false");
+    } else if(streq(name, "mirror")) {
+        snprintf(response, BUFSIZ, "%s\n", curmon->mirror ? "true" : "false");
+    } else if(streq(name, "stats")) {
+        snprintf(response, BUFSIZ, "events %lu commands %lu merged %lu event-latency-avg %lluns event-latency-max %lluns\n",
+            stats.events, stats.commands, stats.merged,
+            stats.events ? stats.event_latency / stats.events : 0,
+            stats.event_latency_max);
+    } else if(streq(name, "fullscreen-hide")) {
+        snprintf(response, BUFSIZ, "%s\n", fullscreen_hide ? "true" : "false");
+    } else if(streq(name, "focus-mode")) {
+        snprintf(response, BUFSIZ, "%s\n", focus_mode == FOCUS_POINTER ? "pointer" : "click");
+    } else if(streq(name, "arrange-interval")) {
+        snprintf(response, BUFSIZ, "%u\n", arrange_interval);
+    } else if(streq(name, "focus-delay")) {
+        snprintf(response, BUFSIZ, "%u\n", focus_delay);
+    } else if(streq(name, "ping-timeout")) {
+        snprintf(response, BUFSIZ, "%u\n", ping_timeout);
+    } else if(streq(name, "stats-interval")) {
+        snprintf(response, BUFSIZ, "%u\n", stats_interval);
+    } else if(streq(name, "trace")) {
+        snprintf(response, BUFSIZ, "%s\n", trace_file ? trace_path : "off");
+    }
+}
+
+struct rule *
+make_rule(const char *name) {
+    struct rule *rule = malloc(sizeof(*rule));
+    strncpy(rule->name, name, sizeof(rule->name));
+    rule->floating = false;
+    rule->fullscreen = false;
+    rule->has_color = false;
+    return rule;
+}
+
+enum command_type
+command_type(const char *name) {
+    for(unsigned i = 1; i < COMMAND_MAX; i++) {
+        if(streq(name, command_names[i])) return i;
+    }
+
+    return COMMAND_UNKNOWN;
+}
+
+void
+parse_command(struct command *command) {
+    char *save = NULL;
+    char *token = strtok_r(command->buffer, " \t\n", &save);
+
+    command->type = COMMAND_UNKNOWN;
+    command->argc = 0;
+    command->arg = 1;
+
+    while(token && command->argc < MAXARGS) {
+        command->argv[command->argc++] = token;
+        token = strtok_r(NULL, " \t\n", &save);
+    }
+
+    if(!command->argc) return;
+
+    command->type = command_type(command->argv[0]);
+}
+
+const char *
+next_argument(struct command *command) {
+    if(command->arg >= command->argc) return NULL;
+    return command->argv[command->arg++];
+}
+
+/*
+ * Window selectors pick windows by their state, as the remaining arguments
+ * of a command, all of which must match:
+ *
+ *   class=<name>, instance=<name>, monitor=<id>, title~<regex>,
+ *   floating, tiled, fullscreen, urgent, transient
+ *
+ * Only the monitor asked for is walked, and only its floating or tiled
+ * sequence when one is asked for. Class and title are requested for every
+ * candidate before any is compared, so matching costs one round-trip.
+ */
+struct selector {
+    const char          *class;
+    const char          *instance;
+    int                 monitor;
+    int                 floating;
+    unsigned            fullscreen;
+    unsigned            urgent;
+    unsigned            transient;
+    unsigned            has_title;
+    regex_t             title;
+};
+
+bool
+is_selector(const char *param) {
+    static const char *flags[] = { "floating", "tiled", "fullscreen", "urgent", "transient" };
+
+    if(strchr(param, '=') || strchr(param, '~')) return true;
+
+    for(unsigned i = 0; i < LENGTH(flags); i++) {
+        if(streq(param, flags[i])) return true;
+    }
+
+    return false;
+}
+
+void
+free_selector(struct selector *selector) {
+    if(selector->has_title) regfree(&selector->title);
+}
+
+bool
+parse_selector(struct selector *selector, struct command *command, char *response) {
+    const char *term;
+
+    *selector = (struct selector) { .monitor = -1, .floating = -1 };
+
+    while((term = next_argument(command))) {
+        if(!strncmp(term, "class=", 6)) {
+            selector->class = term + 6;
+        } else if(!strncmp(term, "instance=", 9)) {
+            selector->instance = term + 9;
+        } else if(!strncmp(term, "monitor=", 8)) {
+            char *end;
+            long id = strtol(term + 8, &end, 10);
+
+            if(end == term + 8 || *end || id < 0 || id > INT_MAX) break;
+            selector->monitor = id;
+        } else if(!strncmp(term, "title~", 6)) {
+            if(selector->has_title) regfree(&selector->title);
+            selector->has_title = !regcomp(&selector->title, term + 6, REG_EXTENDED | REG_NOSUB);
+            if(!selector->has_title) break;
+        } else if(streq(term, "floating")) {
+            selector->floating = true;
+        } else if(streq(term, "tiled")) {
+            selector->floating = false;
+        } else if(streq(term, "fullscreen")) {
+            selector->fullscreen = true;
+        } else if(streq(term, "urgent")) {
+            selector->urgent = true;
+        } else if(streq(term, "transient")) {
+            selector->transient = true;
+        } else {
+            break;
+        }
+    }
+
+    if(term) {
+        snprintf(response, BUFSIZ, "error: invalid selector: %s\n", term);
+        free_selector(selector);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+match_selector(const struct selector *selector, struct window *window) {
+    if(selector->fullscreen && !window->fullscreen) return false;
+    if(selector->urgent && !window->urgent) return false;
+    if(selector->transient && !window->transient) return false;
+
+    if(selector->class || selector->instance) window_class(window);
+
+    if(selector->class && !streq(selector->class, window->class)) return false;
+    if(selector->instance && !streq(selector->instance, window->instance)) return false;
+
+    if(selector->has_title && regexec(&selector->title, window_title(window), 0, NULL, 0)) return false;
+
+    return true;
+}
+
+// Collects the windows matching the selector that makes up the rest of the
+// command, tiles before floating windows, each in sequence order. Returns
+// NULL with an error in response if the selector is invalid.
+struct window **
+select_windows(struct command *command, char *response, unsigned *count) {
+    struct selector selector;
+    struct monitor *monitor;
+    struct window *window;
+    unsigned n = 0, total = 0;
+
+    if(!parse_selector(&selector, command, response)) return NULL;
+
+    each_node_entry(monitor, &monitors, node)
+        total += monitor->window_count;
+
+    struct window **matches = malloc((total + 1) * sizeof(*matches));
+
+    each_node_entry(monitor, &monitors, node) {
+        if(selector.monitor >= 0 && monitor->id != (unsigned) selector.monitor) continue;
+
+        if(selector.floating != true) {
+            each_seq_entry(window, &monitor->tiles, position)
+                matches[n++] = window;
+        }
+
+        if(selector.floating != false) {
+            each_seq_entry(window, &monitor->floats, position)
+                matches[n++] = window;
+        }
+    }
+
+    for(unsigned i = 0; i < n; i++) {
+        if(selector.class || selector.instance) request_property(matches[i], PROPERTY_CLASS);
+        if(selector.has_title) request_property(matches[i], PROPERTY_NAME);
+    }
+
+    *count = 0;
+
+    for(unsigned i = 0; i < n; i++) {
+        if(match_selector(&selector, matches[i])) matches[(*count)++] = matches[i];
+    }
+
+    free_selector(&selector);
+
+    return matches;
+}
+
+// Focuses the first matching window after the focused one, so repeating
+// the command cycles through the matches.
+unsigned
+select_matching(struct command *command, char *response) {
+    unsigned count, next = 0;
+    struct window **matches = select_windows(command, response, &count);
+
+    if(!matches) return false;
+
+    for(unsigned i = 0; i < count; i++) {
+        if(matches[i] == curmon->curwin) next = (i + 1) % count;
+    }
+
+    if(count) focus(matches[next]);
+
+    free(matches);
+
+    return count > 0;
+}
+
+unsigned
+load_config(const char *, unsigned);
+
+void
+process_command(struct command *, struct response *);
+
+struct macro *
+find_macro(const char *name) {
+    struct macro *macro;
+
+    each_node_entry(macro, &macros, node) {
+        if(streq(macro->name, name)) return macro;
+    }
+
+    return NULL;
+}
+
+void
+free_macro(struct macro *macro) {
+    node_remove(&macro->node);
+    free(macro->steps);
+    free(macro->strings);
+    free(macro);
+}
+
+/*
+ * macro define <name> <command> [args]; <command> [args]; ...
+ *
+ * Steps are split on `;' and stored tokenized, with command types resolved
+ * and `$n' arguments recorded as parameter slots, so running a macro only
+ * fills in pointers.
+ */
+bool
+define_macro(struct command *command, char *response) {
+    const char *name = next_argument(command);
+    unsigned first = command->arg, size = 0, steps = 1;
+
+    if(!name || first >= command->argc) {
+        snprintf(response, BUFSIZ, "error: macro define <name> <command>; ...\n");
+        return false;
+    }
+
+    // The parser stops at MAXARGS, the rest of the definition was dropped.
+    if(command->argc == MAXARGS) {
+        snprintf(response, BUFSIZ, "error: macro %s: more than %u arguments\n", name, MAXARGS);
+        return false;
+    }
+
+    for(unsigned i = first; i < command->argc; i++) {
+        size_t length = strlen(command->argv[i]);
+
+        size += length + 1;
+        if(length && command->argv[i][length - 1] == ';') steps++;
+    }
+
+    struct macro *macro = calloc(1, sizeof(*macro));
+    macro->steps = calloc(steps, sizeof(*macro->steps));
+    macro->strings = malloc(size);
+    strncpy(macro->name, name, sizeof(macro->name) - 1);
+
+    char *strings = macro->strings;
+    struct macro_step *step = NULL;
+
+    for(unsigned i = first; i < command->argc; i++) {
+        char *token = strings;
+        size_t length = strlen(command->argv[i]);
+        unsigned end = length && command->argv[i][length - 1] == ';';
+
+        memcpy(token, command->argv[i], length + 1);
+        strings += length + 1;
+
+        if(end) token[--length] = 0;
+
+        if(length) {
+            if(!step) {
+                step = &macro->steps[macro->step_count++];
+                step->type = command_type(token);
+
+                if(step->type == COMMAND_UNKNOWN || step->type == COMMAND_MACRO) {
+                    snprintf(response, BUFSIZ, "error: macro %s: invalid command: %s\n", name, token);
+                    free(macro->steps);
+                    free(macro->strings);
+                    free(macro);
+                    return false;
+                }
+            }
+
+            if(step->argc < MAXARGS) {
+                unsigned param = 0;
+                if(token[0] == '$' && sscanf(token + 1, "%u", &param) != 1) param = 0;
+
+                macro->params = MAX(macro->params, param);
+                step->param[step->argc] = param;
+                step->argv[step->argc++] = token;
+            }
+        }
+
+        if(end) step = NULL;
+    }
+
+    struct macro *old = find_macro(name);
+    if(old) free_macro(old);
+
+    node_append(&macro->node, &macros);
+    p("defined macro `%s', %u steps", macro->name, macro->step_count);
+
+    return true;
+}
+
+// All steps run inside the caller's batch, so the monitors they touch are
+// arranged once and the connection is flushed once, after the last step.
+bool
+run_macro(struct command *command, struct response *reply) {
+    const char *name = next_argument(command);
+    struct macro *macro;
+
+    if(!name || !(macro = find_macro(name))) {
+        snprintf(reply->data, BUFSIZ, "error: unknown macro: %s\n", name ? name : "");
+        return false;
+    }
+
+    unsigned first = command->arg, params = command->argc - first;
+    struct command step_command;
+
+    // Checked up front so a missing argument does not leave the macro half run.
+    if(macro->params > params) {
+        snprintf(reply->data, BUFSIZ, "error: macro %s: missing argument $%u\n", name, params + 1);
+        return false;
+    }
+
+    for(unsigned i = 0; i < macro->step_count; i++) {
+        const struct macro_step *step = &macro->steps[i];
+
+        step_command.type = step->type;
+        step_command.fd = command->fd;
+        step_command.argc = step->argc;
+        step_command.arg = 1;
+
+        for(unsigned j = 0; j < step->argc; j++) {
+            unsigned param = step->param[j];
+            step_command.argv[j] = param ? command->argv[first + param - 1] : step->argv[j];
+        }
+
+        process_command(&step_command, reply);
+    }
+
+    return true;
+}
+
+void
+arrange_deferred(void);
+
+// Rejected arguments are reported like other errors, so a config line
+// with a bad value counts as failed instead of passing silently.
+void
+invalid_argument(struct command *command, char *response) {
+    snprintf(response, BUFSIZ, "error: %s: invalid argument\n", command->argv[0]);
+}
+
+void
+process_command(struct command *command, struct response *reply) {
+    char *response = reply->data;
+
+    if(!command->argc) return;
+
+    debug("command: %s", command->argv[0]);
+
+    stats.commands += 1;
+
+    switch(command->type) {
+        case COMMAND_TRACE: {
+            const char *param = next_argument(command);
+
+            if(!param) return;
+
+            if(streq(param, "stop")) {
+                trace_stop();
+            } else if(!trace_begin(param)) {
+                snprintf(response, BUFSIZ, "could not open %s\n", param);
+            }
+
+            return;
+        }
+
+        case COMMAND_ARRANGE_INTERVAL:
+        case COMMAND_FOCUS_DELAY:
+        case COMMAND_PING_TIMEOUT:
+        case COMMAND_STATS_INTERVAL: {
+            const char *param = next_argument(command);
+            unsigned ms;
+
+            if(!param || sscanf(param, "%u", &ms) != 1) {
+                invalid_argument(command, response);
+                return;
+            }
+
+            switch(command->type) {
+                case COMMAND_ARRANGE_INTERVAL:  arrange_interval = ms; break;
+                case COMMAND_FOCUS_DELAY:       focus_delay = ms; break;
+                case COMMAND_PING_TIMEOUT:      ping_timeout = ms; break;
+                default: {
+                    stats_interval = ms;
+                    if(ms) schedule(&stats_timer, ms);
+                    else unschedule(&stats_timer);
+                }
+            }
+
+            return;
+        }
+
+        case COMMAND_MACRO: {
+            const char *action = next_argument(command);
+            if(!action) return;
+
+            if(streq(action, "define")) {
+                define_macro(command, response);
+            } else if(streq(action, "run")) {
+                if(!run_macro(command, reply)) return;
+                break;
+            } else if(streq(action, "remove")) {
+                struct macro *macro;
+                const char *name = next_argument(command);
+                if(name && (macro = find_macro(name))) free_macro(macro);
+            }
+
+            return;
+        }
+
+        case COMMAND_RELOAD: {
+            if(!config_path) {
+                snprintf(response, BUFSIZ, "error: no config file\n");
+                return;
+            }
+
+            unsigned errors = load_config(config_path, true);
+            snprintf(response, BUFSIZ, "%u errors\n", errors);
+            return;
+        }
+
+        case COMMAND_RESTART: {
+            restarting = true;
+            running = false;
+            return;
+        }
+
+        case COMMAND_QUIT: {
+            running = false;
+            break;
+        }
+
+        case COMMAND_BEGIN: {
+            p("command sequence begin")
+            batch = true;
+            return;
+        }
+
+        case COMMAND_END: {
+            p("command sequence end")
+            batch = false;
+            arrange_deferred();
+            break;
+        }
+
+        case COMMAND_DEBUG_WINDOW: {
+            if(curmon->window_count < 1) return;
+            print_window(curmon->curwin);
+            return;
+        }
+
+        case COMMAND_CHECK_SHADOW: {
+            check_shadow(response);
+            return;
+        }
+
+        case COMMAND_LIST_WINDOWS: {
+            list_windows(response);
+            return;
+        }
+
+        case COMMAND_DUMP: {
+            dump(reply, next_argument(command));
+            return;
+        }
+
+        case COMMAND_ROOT_COUNT: {
+            const char *count = next_argument(command);
+            if(!count || !set_root_count(count)) {
+                invalid_argument(command, response);
+                return;
+            }
+            break;
+        }
+
+        case COMMAND_ROOT_SIZE: {
+            const char *size = next_argument(command);
+            if(!size || !set_root_size(size)) {
+                invalid_argument(command, response);
+                return;
+            }
+            break;
+        }
+
+        case COMMAND_WINDOW_GAP: {
+            const char *gap = next_argument(command);
+            if(!gap || sscanf(gap, "%u", &curmon->window_gap) != 1) {
+                invalid_argument(command, response);
+                return;
+            }
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_BORDER_WIDTH: {
+            const char *size = next_argument(command);
+            if(!size || sscanf(size, "%u", &curmon->border_width) != 1) {
+                invalid_argument(command, response);
+                return;
+            }
+
+            struct window *window;
+            each_node_entry(window, &curmon->windows, node) {
+                set_border_width(window, curmon->border_width);
+            }
+
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_PADDING: {
+            const char *direction = next_argument(command);
+            if(!direction) return;
+
+            const char *padding = next_argument(command);
+            if(!padding) return;
+
+            if(streq(direction, "bottom")) {
+                sscanf(padding, "%u", &curmon->padding.h);
+            } else if(streq(direction, "top")) {
+                sscanf(padding, "%u", &curmon->padding.y);
+            } else if(streq(direction, "left")) {
+                sscanf(padding, "%u", &curmon->padding.x);
+            } else if(streq(direction, "right")) {
+                sscanf(padding, "%u", &curmon->padding.w);
+            } else {
+                return;
+            }
+
+            resize_monitor(curmon);
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_FULLSCREEN: {
+            const char *param = next_argument(command);
+            if(!param) return;
+
+            if(command->arg < command->argc) {
+                unsigned toggle = streq(param, "toggle"), on = streq(param, "true") || streq(param, "on");
+                unsigned count;
+                struct window **matches;
+
+                if(!toggle && !on && !streq(param, "false") && !streq(param, "off")) return;
+                if(!(matches = select_windows(command, response, &count))) return;
+
+                // a monitor shows one fullscreen window, so only the first
+                // match that would change on each monitor is applied
+                struct monitor *changed[MAXMONITORS];
+                unsigned changed_count = 0;
+
+                for(unsigned i = 0; i < count; i++) {
+                    unsigned j = 0;
+
+                    if(!toggle && matches[i]->fullscreen == on) continue;
+                    while(j < changed_count && changed[j] != matches[i]->monitor) j++;
+                    if(j < changed_count) continue;
+
+                    changed[changed_count++] = matches[i]->monitor;
+                    toggle_fullscreen(matches[i]);
+                }
+
+                free(matches);
+                break;
+            }
+
+            if(curmon->window_count < 1) return;
+
+            if(streq(param, "toggle")) {
+                toggle_fullscreen(curmon->curwin);
+            } else if(streq(param, "false") || streq(param, "off")) {
+                if(curmon->fullscreen) toggle_fullscreen(curmon->fullscreen);
+            } else if(streq(param, "true") || streq(param, "on")) {
+                if(!curmon->fullscreen) toggle_fullscreen(curmon->curwin);
+            } else {
+                return;
+            }
+            break;
+        }
+
+        case COMMAND_FULLSCREEN_HIDE: {
+            const char *hide = next_argument(command);
+            if(!hide || !parse_boolean(hide, &fullscreen_hide)) {
+                invalid_argument(command, response);
+                return;
+            }
+            return;
+        }
+
+        case COMMAND_COLOR: {
+            const char *slot = next_argument(command);
+            const char *color = next_argument(command);
+            unsigned pixel;
+            int i;
+
+            if(!slot || !color || (i = parse_color_slot(slot)) < 0 || !parse_color(color, &pixel)) {
+                invalid_argument(command, response);
+                return;
+            }
+
+            curmon->colors[i] = pixel;
+            update_border_colors(curmon);
+            break;
+        }
+
+        case COMMAND_MIRROR: {
+            if(curmon->fullscreen) return;
+
+            const char *mirror = next_argument(command);
+            if(!mirror || !parse_boolean(mirror, &curmon->mirror)) {
+                invalid_argument(command, response);
+                return;
+            }
+
+            if(curmon->window_count >= 2) arrange(curmon);
+            break;
+        }
+
+        case COMMAND_GET: {
+            const char *name = next_argument(command);
+            if(!name) return;
+
+            get_parameter(name, response);
+
+            return;
+        }
+
+        case COMMAND_MAKE_ROOT: {
+            if(curmon->fullscreen) return;
+            make_root();
+            break;
+        }
+
+        case COMMAND_SELECT_WINDOW: {
+            if(curmon->fullscreen) return;
+
+            const char *param = next_argument(command);
+            if(!param) return;
+
+            if(is_selector(param)) {
+                command->arg--;
+                select_matching(command, response);
+            } else {
+                select_window(param);
+            }
+            break;
+        }
+
+        case COMMAND_SHIFT_WINDOW: {
+            if(curmon->fullscreen) return;
+
+            const char *param = next_argument(command);
+            if(!param) return;
+
+            shift_window(param);
+            break;
+        }
+
+        case COMMAND_NEXT_LAYOUT: {
+            if(curmon->fullscreen) return;
+
+            if(++curmon->layout >= LAYOUT_MAX) curmon->layout = 0;
+
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_PREVIOUS_LAYOUT: {
+            if(curmon->fullscreen) return;
+
+            if(--curmon->layout <= 0) curmon->layout = LAYOUT_MAX;
+
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_RESET_LAYOUT: {
+            reset_layout(curmon);
+
+            arrange(curmon);
+            break;
+        }
+
+        case COMMAND_RULE: {
+            const char *name = next_argument(command);
+            const char *attribute = next_argument(command);
+
+            if(!name || !attribute) {
+                invalid_argument(command, response);
+                return;
+            }
+
+            if(streq(attribute, "floating")) {
+                struct rule *rule = make_rule(name);
+                rule->floating = true;
+                node_append(&rule->node, &rules);
+                p("adding rule `floating' to `%s'", rule->name);
+            } else if(streq(attribute, "fullscreen")) {
+                struct rule *rule = make_rule(name);
+                rule->fullscreen = true;
+                node_append(&rule->node, &rules);
+                p("adding rule `fullscreen' to `%s'", rule->name);
+            } else if(streq(attribute, "color")) {
+                const char *color = next_argument(command);
+                unsigned pixel;
+                if(!color || !parse_color(color, &pixel)) {
+                    invalid_argument(command, response);
+                    return;
+                }
+
+                struct rule *rule = make_rule(name);
+                rule->has_color = true;
+                rule->color = pixel;
+                node_append(&rule->node, &rules);
+                p("adding rule `color %s' to `%s'", color, rule->name);
+            } else {
+                invalid_argument(command, response);
+                return;
+            }
+
+            return;
+        }
+
+        case COMMAND_GRAB_POINTER: {
+            if(curmon->fullscreen) return;
+
+            const char *action = next_argument(command);
+            if(!action) return;
+
+            struct window *window;
+            if(!(window = hover)) return;
+
+            p("grabbing pointer for -> 0x%08x, `%s'", window->id, window->class);
+
+            if(streq(action, "move")) {
+                pointer->action = ACTION_MOVE;
+            } else if(streq(action, "resize")) {
+                pointer->action = ACTION_RESIZE;
+            } else {
+                return;
+            }
+
+            const char *sx = next_argument(command);
+            const char *sy = next_argument(command);
+
+            pointer->anchored = sx && sy &&
+                sscanf(sx, "%u", &pointer->x) == 1 &&
+                sscanf(sy, "%u", &pointer->y) == 1;
+
+            if(!window->floating) {
+                float_window(window);
+                arrange(window->monitor);
+            }
+
+            pointer->window = window;
+            pointer->geometry = window->geometry;
+
+            raise_window(window);
+            focus(window);
+            break;
+        }
+
+        case COMMAND_TRACK_POINTER: {
+            const char *sx = next_argument(command);
+            const char *sy = next_argument(command);
+            unsigned dx, dy, x, y;
+
+            if(!sx || !sy || !pointer->window) return;
+
+            sscanf(sx, "%u", &x);
+            sscanf(sy, "%u", &y);
+
+            if(!pointer->anchored) {
+                pointer->x = x;
+                pointer->y = y;
+                pointer->anchored = true;
+                return;
+            }
+
+            dx = x - pointer->x;
+            dy = y - pointer->y;
+
+            move(pointer->window, pointer->geometry.x + dx, pointer->geometry.y + dy);
+            break;
+        }
+
+        case COMMAND_UNGRAB_POINTER: {
+            if(!pointer->window) return;
+
+            p("ungrabbing pointer");
+
+            pointer->window->geometry = pointer->window->shadow.geometry;
+            remember_geometry(pointer->window);
+
+            pointer->window = NULL;
+            pointer->action = ACTION_NONE;
+            break;
+        }
+
+        case COMMAND_SEND_WINDOW: {
+            const char *param = next_argument(command);
+            struct monitor *monitor;
+            struct window *window = curmon->curwin;
+            unsigned id;
+
+            if(!param || sscanf(param, "%u", &id) != 1) return;
+            if(!(monitor = get_monitor_from_id(id))) return;
+
+            if(command->arg < command->argc) {
+                unsigned count;
+                struct window **matches = select_windows(command, response, &count);
+
+                if(!matches) return;
+
+                // every monitor a window left is arranged once, with the target
+                for(unsigned i = 0; i < count; i++) {
+                    struct monitor *from = matches[i]->monitor;
+
+                    if(from == monitor) continue;
+                    send_window(matches[i], monitor);
+                    from->deferred = true;
+                }
+
+                monitor->deferred = true;
+                arrange_deferred();
+
+                // a suspended tile leaves the focus on the window covering it
+                if(count) focus(matches[0]->suspended ? matches[0]->monitor->fullscreen : matches[0]);
+
+                free(matches);
+                break;
+            }
+
+            if(!window || monitor == curmon) return;
+
+            struct monitor *from = curmon;
+
+            send_window(window, monitor);
+            arrange(from);
+            arrange(monitor);
+
+            focus(window->suspended ? monitor->fullscreen : window);
+            break;
+        }
+
+        case COMMAND_CLOSE_WINDOW: {
+            if(command->arg < command->argc) {
+                unsigned count;
+                struct window **matches = select_windows(command, response, &count);
+
+                if(!matches) return;
+
+                for(unsigned i = 0; i < count; i++) {
+                    delete_window(matches[i]);
+                }
+
+                free(matches);
+                break;
+            }
+
+            if(!curmon->curwin) return;
+
+            delete_window(curmon->curwin);
+            break;
+        }
+
+        case COMMAND_FOCUS_WINDOW: {
+            if(!hover || hover == curmon->curwin) return;
+
+            focus(hover);
+            break;
+        }
+
+        case COMMAND_FOCUS_MODE: {
+            const char *mode = next_argument(command);
+            if(!mode) return;
+
+            if(streq(mode, "pointer")) {
+                focus_mode = FOCUS_POINTER;
+                if(hover) focus(hover);
+            } else if(streq(mode, "click")) {
+                focus_mode = FOCUS_CLICK;
+            } else {
+                invalid_argument(command, response);
+                return;
+            }
+            break;
+        }
+
+        case COMMAND_TOGGLE_FLOATING: {
+            if(command->arg < command->argc) {
+                unsigned count;
+                struct window **matches = select_windows(command, response, &count);
+
+                if(!matches) return;
+
+                for(unsigned i = 0; i < count; i++) {
+                    if(matches[i]->monitor->fullscreen) continue;
+
+                    toggle_floating(matches[i]);
+                    arrange(matches[i]->monitor);
+                }
+
+                free(matches);
+                break;
+            }
+
+            if(curmon->fullscreen) return;
+
+            if(curmon->curwin) {
+                toggle_floating(curmon->curwin);
+                arrange(curmon);
+            }
+            break;
+        }
+
+        default: {
+            snprintf(response, BUFSIZ, "unknown command: %s\n", command->argv[0]);
+            return;
+        }
+    }
+
+    flush();
+}
+
+void
+clear_rules(void) {
+    struct rule *rule, *r;
+
+    each_node_entry_safe(rule, r, &rules, node) {
+        node_remove(&rule->node);
+        free(rule);
+    }
+}
+
+/*
+ * Applies a config file with the IPC command grammar, one command per line.
+ * `#' starts a comment, and a leading `muoc' plus begin/end lines are
+ * accepted so a muonrc shell script can be loaded as is. The whole file is
+ * one batch: monitors are arranged and the connection flushed once at the
+ * end. Returns the number of lines that failed.
+ */
+unsigned
+load_config(const char *path, unsigned reload) {
+    FILE *file = fopen(path, "r");
+
+    if(!file) {
+        p("config %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    unsigned long long start = now();
+    unsigned line = 0, count = 0, errors = 0;
+    struct command command;
+    struct response reply;
+    char *response = reply.data;
+
+    if(reload) {
+        clear_rules();
+    }
+
+    unsigned nested = deferring;
+    deferring = true;
+
+    while(fgets(command.buffer, sizeof(command.buffer), file)) {
+        line++;
+
+        size_t length = strlen(command.buffer);
+
+        if(length == sizeof(command.buffer) - 1 && command.buffer[length - 1] != '\n') {
+            p("%s:%u: line too long", path, line);
+            errors++;
+            for(int c; (c = fgetc(file)) != EOF && c != '\n'; );
+            continue;
+        }
+
+        char *comment = strchr(command.buffer, '#');
+        if(comment) *comment = 0;
+
+        parse_command(&command);
+
+        if(command.argc && streq(command.argv[0], "muoc")) {
+            memmove(command.argv, command.argv + 1, (command.argc - 1) * sizeof(*command.argv));
+            command.argc -= 1;
+            command.type = command.argc ? command_type(command.argv[0]) : COMMAND_UNKNOWN;
+        }
+
+        if(!command.argc) continue;
+
+        switch(command.type) {
+            case COMMAND_BEGIN:
+            case COMMAND_END:
+                continue;
+
+            case COMMAND_RELOAD:
+            case COMMAND_RESTART:
+            case COMMAND_UNKNOWN:
+                p("%s:%u: %s: %s", path, line, command.type ? "not allowed in config" : "unknown command", command.argv[0]);
+                errors++;
+                continue;
+
+            default:
+                break;
+        }
+
+        response[0] = 0;
+        reply.stream = NULL;
+        command.fd = -1;
+        process_command(&command, &reply);
+        free(reply.stream);
+        count++;
+
+        if(!strncmp(response, "error", 5)) {
+            p("%s:%u: %s", path, line, response);
+            errors++;
+        }
+    }
+
+    fclose(file);
+
+    deferring = nested;
+
+    struct monitor *monitor;
+    each_node_entry(monitor, &monitors, node) {
+        arrange(monitor);
+        update_border_colors(monitor);
+    }
+
+    flush();
+
+    p("config %s: %u commands, %u errors in %lluus", path, count, errors, (now() - start) / 1000);
+
+    return errors;
+}
+
+void
+process_state(struct window *window, xcb_atom_t state, unsigned action) {
+    if(state == ewmh->_NET_WM_STATE_FULLSCREEN) {
+        p("  FULLSCREEN");
+
+        if(action == XCB_EWMH_WM_STATE_TOGGLE) {
+            p("   TOGGLE");
+            toggle_fullscreen(window);
+        } else if(action == XCB_EWMH_WM_STATE_REMOVE && window->fullscreen) {
+            p("   REMOVE");
+            toggle_fullscreen(window);
+        } else if(action == XCB_EWMH_WM_STATE_ADD && !window->fullscreen) {
+            p("   ADD");
+            toggle_fullscreen(window);
+        }
+    }
+
+#define pstate(id) \
+    if(state == ewmh->_NET_WM_STATE_##id) { \
+        p("   "#id); \
+    } \
+
+    pstate(MODAL);
+    pstate(STICKY);
+    pstate(MAXIMIZED_VERT);
+    pstate(MAXIMIZED_HORZ);
+    pstate(SHADED);
+    pstate(SKIP_TASKBAR);
+    pstate(SKIP_PAGER);
+    pstate(HIDDEN);
+    pstate(ABOVE);
+    pstate(BELOW);
+    pstate(DEMANDS_ATTENTION);
+}
+
+void
+process_alarm(xcb_sync_alarm_notify_event_t *e) {
+    struct window *window;
+    unsigned long long value = ((unsigned long long) e->counter_value.hi << 32) | e->counter_value.lo;
+
+    each_node_entry(window, &syncs, sync_node) {
+        if(window->sync.alarm == e->alarm) {
+            if(value >= window->sync.value) {
+                debug("sync acknowledged for 0x%08x", window->id);
+                sync_done(window);
+            }
+
+            return;
+        }
+    }
+}
+
+void
+process_event(xcb_generic_event_t *event) {
+    if(sync_event_base && XCB_EVENT_RESPONSE_TYPE(event) == sync_event_base + XCB_SYNC_ALARM_NOTIFY) {
+        process_alarm((xcb_sync_alarm_notify_event_t *) event);
+        flush();
+        return;
+    }
+
+    if(randr_event_base && XCB_EVENT_RESPONSE_TYPE(event) == randr_event_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
+        xcb_randr_screen_change_notify_event_t *e = (xcb_randr_screen_change_notify_event_t *) event;
+        p("screen-change %dx%d", e->width, e->height);
+        w = e->width;
+        h = e->height;
+        monitors_changed = true;
+        return;
+    }
+
+    // An output turned on or moved within the same screen size sends no
+    // screen change, only these.
+    if(randr_event_base && XCB_EVENT_RESPONSE_TYPE(event) == randr_event_base + XCB_RANDR_NOTIFY) {
+        xcb_randr_notify_event_t *e = (xcb_randr_notify_event_t *) event;
+
+        if(e->subCode == XCB_RANDR_NOTIFY_CRTC_CHANGE || e->subCode == XCB_RANDR_NOTIFY_OUTPUT_CHANGE) {
+            p("randr-notify %s", e->subCode == XCB_RANDR_NOTIFY_CRTC_CHANGE ? "crtc" : "output");
+            monitors_changed = true;
+        }
+
+        return;
+    }
+
+    switch (XCB_EVENT_RESPONSE_TYPE(event)) {
+        case XCB_MAP_REQUEST: {
+            xcb_map_request_event_t *e = (xcb_map_request_event_t *) event;
+
+            pwinid("map-request", e->window);
+
+            struct window *parent = find_window(e->parent);
+            if(parent) p("parent 0x%08x -> `%s'", parent->id, parent->class);
+
+            xcb_get_window_attributes_reply_t *attr = get_attributes(e->window);
+            unsigned override_redirect = attr->override_redirect;
+            free(attr);
+
+            if(override_redirect) {
+                p("ignoring window 0x%08x -> override_redirect", e->window);
+                return;
+            }
+
+            if(find_window(e->window)) {
+                p("ignoring window 0x%08x -> already managed", e->window);
+                return;
+            }
+
+            struct window *window = add_window(curmon, e->window);
+
+            // Behind a fullscreen window it is suspended like the other
+            // tiles, and left unmapped until they are resumed if those are.
+            if(obscured(window)) {
+                window->suspended = true;
+                window->hidden = fullscreen_hide;
+            }
+
+            if(!window->hidden) xcb_map_window(connection, e->window);
+            restack();
+
+            if(!window->floating) arrange(window->monitor);
+
+            if(!window->suspended) focus(window);
+
+            break;
+        }
+
+        case XCB_MAP_NOTIFY: {
+            xcb_map_notify_event_t *e = (xcb_map_notify_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            window->shadow.mapped = true;
+
+            pwin("map-notify", window);
+
+            break;
+        }
+
+        case XCB_DESTROY_NOTIFY: {
+            xcb_destroy_notify_event_t *e = (xcb_destroy_notify_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            pwin("destroy-notify", window);
+
+            if(!remove_window(window)) return;
+
+            break;
+        }
+
+        case XCB_UNMAP_NOTIFY: {
+            xcb_unmap_notify_event_t *e = (xcb_unmap_notify_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            window->shadow.mapped = false;
+
+            if(window->ignore_unmap) {
+                window->ignore_unmap -= 1;
+                debug("ignoring unmap-notify for hidden window");
+                return;
+            }
+
+            pwin("unmap-notify", window);
+
+            if(!remove_window(window)) return;
+
+            break;
+        }
+
+        case XCB_CLIENT_MESSAGE: {
+            xcb_client_message_event_t *e = (xcb_client_message_event_t *) event;
+
+            struct window *window;
+
+            if(e->window == root && e->type == wm_protocols_atom && e->data.data32[0] == ewmh->_NET_WM_PING) {
+                if((window = find_window(e->data.data32[2]))) {
+                    debug("pong from 0x%08x", window->id);
+                    unschedule(&window->ping_timer);
+                }
+
+                return;
+            }
+
+            if(!(window = find_window(e->window))) return;
+
+            pwin("client-message", window);
+
+            if (e->type == ewmh->_NET_WM_STATE) {
+                p(" state");
+
+                process_state(window, e->data.data32[1], e->data.data32[0]);
+                process_state(window, e->data.data32[2], e->data.data32[0]);
+            }
+
+            break;
+        }
+
+        case XCB_ENTER_NOTIFY: {
+            xcb_enter_notify_event_t *e = (xcb_enter_notify_event_t *) event;
+
+            if(e->mode != XCB_NOTIFY_MODE_NORMAL) return;
+
+            if(e->event == root) {
+                // the virtual details pass through the root into a window
+                root_motion(e->detail == XCB_NOTIFY_DETAIL_INFERIOR ||
+                    e->detail == XCB_NOTIFY_DETAIL_NONLINEAR);
+                hover = NULL;
+                unschedule(&focus_timer);
+                focus_monitor(get_monitor_from_point(e->root_x, e->root_y));
+                break;
+            }
+
+            if(e->detail == XCB_NOTIFY_DETAIL_INFERIOR) return;
+
+            struct window *window;
+
+            if(!(window = find_window(e->event))) return;
+
+            debug("enter-notify for 0x%08x", window->id);
+
+            hover = window;
+
+            // the window moved under the pointer, the pointer did not move
+            if((int) (event->full_sequence - enter_sequence) < 0) return;
+
+            if(focus_mode == FOCUS_POINTER && focus_delay) {
+                schedule(&focus_timer, focus_delay);
+            } else if(focus_mode == FOCUS_POINTER) {
+                focus(window);
+            } else {
+                focus_monitor(window->monitor);
+            }
+
+            break;
+        }
+
+        case XCB_LEAVE_NOTIFY: {
+            xcb_leave_notify_event_t *e = (xcb_leave_notify_event_t *) event;
+
+            if(e->event != root || e->mode != XCB_NOTIFY_MODE_NORMAL) return;
+
+            root_motion(false);
+            break;
+        }
+
+        // Selected while the pointer is over no window, so the monitor under
+        // it may have no window to enter either.
+        case XCB_MOTION_NOTIFY: {
+            xcb_motion_notify_event_t *e = (xcb_motion_notify_event_t *) event;
+
+            if(e->child != XCB_NONE) return;
+
+            focus_monitor(get_monitor_from_point(e->root_x, e->root_y));
+            break;
+        }
+
+        case XCB_FOCUS_IN: {
+            xcb_focus_in_event_t *e = (xcb_focus_in_event_t *) event;
+
+            if(e->mode == XCB_NOTIFY_MODE_GRAB || e->mode == XCB_NOTIFY_MODE_UNGRAB) return;
+            if(e->detail == XCB_NOTIFY_DETAIL_POINTER) return;
+
+            // caused by a focus change muon has since replaced
+            if((int) (event->full_sequence - focus_sequence) < 0) return;
+
+            struct window *window;
+
+            if(!(window = find_window(e->event))) return;
+            if(window == curmon->curwin) return;
+
+            pwin("focus-in", window);
+
+            focus(window);
+
+            break;
+        }
+
+        case XCB_PROPERTY_NOTIFY: {
+            xcb_property_notify_event_t *e = (xcb_property_notify_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            property_changed(window, e->atom);
+
+            return;
+        }
+
+        case XCB_CONFIGURE_NOTIFY: {
+            xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            // a notify for a state muon already asked to replace would
+            // undo the shadow and suppress the next identical request
+            if((int) (event->full_sequence - window->shadow.sequence) >= 0) {
+                window->shadow.geometry = (struct geometry) { e->x, e->y, e->width, e->height };
+                window->shadow.border_width = e->border_width;
+            }
+
+            if(pointer->window == window) {
+                debug("ignoring configure-notify for grabbed window");
+                return;
+            }
+
+            p("configure-notify for 0x%08x -> `%s'", window->id, window->class);
+
+            break;
+        }
+
+        case XCB_CONFIGURE_REQUEST: {
+            xcb_configure_request_event_t *e = (xcb_configure_request_event_t *) event;
+
+            struct window *window;
+
+            if(!(window = find_window(e->window))) return;
+
+            if(pointer->window == window) {
+                debug("ignoring configure-request for grabbed window");
+                return;
+            }
+
+            p("configure request for 0x%08x -> `%s'", window->id, window->class);
+
+            if(window->floating) {
+                unsigned i = 0, mask = 0, values[7];
+
+                if(e->value_mask & XCB_CONFIG_WINDOW_X) {
+                    mask |= XCB_CONFIG_WINDOW_X;
+                    values[i++] = e->x;
+                    window->geometry.x = e->x;
+                }
+
+                if(e->value_mask & XCB_CONFIG_WINDOW_Y) {
+                    mask |= XCB_CONFIG_WINDOW_Y;
+                    values[i++] = e->y;
+                    window->geometry.y = e->y;
+                }
+
+                if(e->value_mask & XCB_CONFIG_WINDOW_WIDTH) {
+                    mask |= XCB_CONFIG_WINDOW_WIDTH;
+                    values[i++] = e->width;
+                    window->geometry.w = e->width;
+                }
+
+                if(e->value_mask & XCB_CONFIG_WINDOW_HEIGHT) {
+                    mask |= XCB_CONFIG_WINDOW_HEIGHT;
+                    values[i++] = e->height;
+                    window->geometry.h = e->height;
+                }
+
+                window->shadow.geometry = window->geometry;
+                configure_window(window, mask, values);
+            } else if(window->suspended) {
+                debug("deferring configure-notify for suspended window");
+                window->pending_notify = true;
+                return;
+            } else {
+                send_configure_notify(window);
+            }
+
+            break;
+        }
+
+        default: {
+            p("ignored event %d, %s", event->response_type, event_to_string(event->response_type));
+
+            return;
+         }
+    }
+
+    flush();
+}
+
+/*
+ * Restart snapshot: a header followed by rules, monitors and windows, each
+ * a fixed-size record. Windows are written per monitor, tiles first, in
+ * sequence order, so appending them on restore reproduces the layout.
+ */
+
+struct snapshot_header {
+    uint32_t            magic;
+    uint32_t            version;
+    uint32_t            record_sizes[4];
+    uint32_t            rule_count;
+    uint32_t            macro_count;
+    uint32_t            monitor_count;
+    uint32_t            window_count;
+    uint32_t            focus_mode;
+    uint32_t            fullscreen_hide;
+    uint32_t            arrange_interval;
+    uint32_t            focus_delay;
+    uint32_t            ping_timeout;
+    uint32_t            stats_interval;
+    uint32_t            curmon;
+};
+
+struct snapshot_rule {
+    char                name[MAXLEN];
+    uint32_t            floating;
+    uint32_t            fullscreen;
+    uint32_t            has_color;
+    uint32_t            color;
+};
+
+// The definition as a `macro define' command, replayed on restore.
+struct snapshot_macro {
+    char                definition[BUFSIZ];
+};
+
+struct snapshot_monitor {
+    xcb_randr_output_t  output;
+    struct geometry     base_geometry;
+    struct geometry     padding;
+    uint32_t            root_count;
+    float               root_size;
+    uint32_t            mirror;
+    uint32_t            layout;
+    uint32_t            border_width;
+    uint32_t            window_gap;
+    uint32_t            colors[COLOR_MAX];
+    xcb_window_t        curwin;
+};
+
+struct snapshot_window {
+    xcb_window_t        id;
+    xcb_window_t        transient;
+    uint32_t            monitor;
+    struct geometry     geometry;
+    struct geometry     server_geometry;
+    uint32_t            border_width;
+    uint32_t            floating;
+    uint32_t            fullscreen;
+    uint32_t            hidden;
+    uint32_t            has_color;
+    uint32_t            color;
+    uint32_t            urgent_hint;
+    uint32_t            can_ping;
+    uint32_t            state;
+    struct hints        hints;
+    xcb_sync_counter_t  counter;
+    char                class[MAXLEN];
+    char                instance[MAXLEN];
+};
+
+const struct snapshot_header snapshot_template = {
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .record_sizes = {
+        sizeof(struct snapshot_rule),
+        sizeof(struct snapshot_macro),
+        sizeof(struct snapshot_monitor),
+        sizeof(struct snapshot_window)
+    }
+};
+
+bool
+write_all(int fd, const void *data, size_t size) {
+    for(const char *p = data; size; ) {
+        ssize_t n = write(fd, p, size);
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
     }
 
-    if(window->floating) {
-        monitor->floating_count -= 1;
-    } else {
-        arrange(monitor);
-    }
+    return true;
+}
 
-    free(window);
+bool
+read_all(int fd, void *data, size_t size) {
+    for(char *p = data; size; ) {
+        ssize_t n = read(fd, p, size);
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
 
     return true;
 }
 
-void
-substructure(void) {
-    unsigned values[] = {
-        XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
-        XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY
-    };
-    xcb_void_cookie_t cookie = xcb_change_window_attributes_checked(connection, root, XCB_CW_EVENT_MASK, values);
+int
+write_snapshot(void) {
+    int fd = memfd_create("muon-snapshot", 0);
 
-    if(xcb_request_check(connection, cookie)) {
-        d("error: could not set substructure_redirect");
+    if(fd < 0) return -1;
+
+    struct snapshot_header header = snapshot_template;
+    struct monitor *monitor;
+    struct window *window;
+    struct rule *rule;
+    struct macro *macro;
+    unsigned index = 0;
+
+    each_node_entry(rule, &rules, node) header.rule_count++;
+    each_node_entry(macro, &macros, node) header.macro_count++;
+
+    each_node_entry(monitor, &monitors, node) {
+        if(monitor == curmon) header.curmon = header.monitor_count;
+        header.monitor_count++;
+        header.window_count += monitor->window_count;
     }
-}
 
-void
-reparent(void) {
-    xcb_query_tree_reply_t *reply = xcb_query_tree_reply(connection, xcb_query_tree(connection, root), NULL);
-    xcb_window_t *c = xcb_query_tree_children(reply);
-    unsigned n = xcb_query_tree_children_length(reply);
-    struct window *window = NULL;
+    header.focus_mode = focus_mode;
+    header.fullscreen_hide = fullscreen_hide;
+    header.arrange_interval = arrange_interval;
+    header.focus_delay = focus_delay;
+    header.ping_timeout = ping_timeout;
+    header.stats_interval = stats_interval;
 
-    for(unsigned i = 0; i < n; i++) {
-        xcb_get_window_attributes_reply_t *attr = get_attributes(c[i]);
-        unsigned override_redirect = attr->override_redirect;
-        unsigned viewable = attr->map_state == XCB_MAP_STATE_VIEWABLE;
+    bool ok = write_all(fd, &header, sizeof(header));
 
-        free(attr);
+    each_node_entry(rule, &rules, node) {
+        struct snapshot_rule record = {
+            .floating = rule->floating,
+            .fullscreen = rule->fullscreen,
+            .has_color = rule->has_color,
+            .color = rule->color,
+        };
+
+        memcpy(record.name, rule->name, sizeof(record.name));
+        ok = ok && write_all(fd, &record, sizeof(record));
+    }
 
-        if(override_redirect) {
-            p("ignoring window 0x%08x -> override_redirect", c[i]);
-            continue;
-        }
+    each_node_entry(macro, &macros, node) {
+        struct snapshot_macro record = { .definition = "" };
+        size_t o = snprintf(record.definition, sizeof(record.definition), "macro define %s", macro->name);
 
-        if(!viewable) {
-            p("ignoring window 0x%08x -> not viewable", c[i]);
-            continue;
+        for(unsigned i = 0; i < macro->step_count; i++) {
+            const struct macro_step *step = &macro->steps[i];
+
+            for(unsigned j = 0; j < step->argc && o < sizeof(record.definition); j++) {
+                o += snprintf(record.definition + o, sizeof(record.definition) - o, " %s%s",
+                    step->argv[j], j == step->argc - 1 && i < macro->step_count - 1 ? ";" : "");
+            }
         }
 
-        xcb_get_geometry_reply_t *geom = get_geometry(c[i]);
-        struct monitor *monitor = get_monitor_from_point(geom->x + (geom->width / 2), geom->y + (geom->height / 2));
-        free(geom);
-        window = add_window(monitor, c[i]);
+        ok = ok && write_all(fd, &record, sizeof(record));
     }
 
-    if(window) {
-        arrange(window->monitor);
-        focus(window);
+    each_node_entry(monitor, &monitors, node) {
+        struct snapshot_monitor record = {
+            .output = monitor->output,
+            .base_geometry = monitor->base_geometry,
+            .padding = monitor->padding,
+            .root_count = monitor->root_count,
+            .root_size = monitor->root_size,
+            .mirror = monitor->mirror,
+            .layout = monitor->layout,
+            .border_width = monitor->border_width,
+            .window_gap = monitor->window_gap,
+            .curwin = monitor->curwin ? monitor->curwin->id : XCB_NONE,
+        };
+
+        memcpy(record.colors, monitor->colors, sizeof(record.colors));
+        ok = ok && write_all(fd, &record, sizeof(record));
     }
 
-    free(reply);
-}
-
-void
-monitor_setup(void) {
-    if(xinerama_is_active()) {
-        xcb_xinerama_query_screens_reply_t *reply = xcb_xinerama_query_screens_reply(connection, xcb_xinerama_query_screens(connection), NULL);
-        xcb_xinerama_screen_info_t *screens = xcb_xinerama_query_screens_screen_info(reply);
-        unsigned n = xcb_xinerama_query_screens_screen_info_length(reply);
+    each_node_entry(monitor, &monitors, node) {
+        struct seq *sequences[] = { &monitor->tiles, &monitor->floats };
+
+        for(unsigned i = 0; i < LENGTH(sequences); i++) {
+            each_seq_entry(window, sequences[i], position) {
+                struct snapshot_window record = {
+                    .id = window->id,
+                    .transient = window->transient ? window->transient->id : XCB_NONE,
+                    .monitor = index,
+                    .geometry = window->geometry,
+                    .server_geometry = window->shadow.geometry,
+                    .border_width = window->shadow.border_width,
+                    .floating = window->floating,
+                    .fullscreen = window->fullscreen,
+                    .hidden = window->hidden,
+                    .has_color = window->has_color,
+                    .color = window->color,
+                    .urgent_hint = window->urgent_hint,
+                    .can_ping = window->can_ping,
+                    .state = window->state,
+                    .hints = window->hints,
+                    .counter = window->sync.counter,
+                };
 
-        for(unsigned i = 0; i < n; i++) {
-            xcb_xinerama_screen_info_t screen = screens[i];
-            add_monitor(screen.x_org, screen.y_org, screen.width, screen.height);
+                memcpy(record.class, window->class, sizeof(record.class));
+                memcpy(record.instance, window->instance, sizeof(record.instance));
+                ok = ok && write_all(fd, &record, sizeof(record));
+            }
         }
 
-        free(reply);
-    } else {
-        add_monitor(0, 0, w, h);
+        index++;
     }
-}
 
-void
-ewmh_setup(void) {
-    ewmh = (xcb_ewmh_connection_t *) malloc(sizeof(*ewmh));
-    xcb_intern_atom_cookie_t *cookies;
-    cookies = xcb_ewmh_init_atoms(connection, ewmh);
-    xcb_ewmh_init_atoms_replies(ewmh, cookies, NULL);
-
-    xcb_atom_t atoms[] = {
-        ewmh->_NET_SUPPORTED,
-        ewmh->_NET_CLIENT_LIST,
-        ewmh->_NET_NUMBER_OF_DESKTOPS,
-        ewmh->_NET_CURRENT_DESKTOP,
-        ewmh->_NET_ACTIVE_WINDOW,
-//      ewmh->_NET_WM_DESKTOP,
-        ewmh->_NET_WM_WINDOW_TYPE,
-        ewmh->_NET_WM_WINDOW_TYPE_DIALOG,
-        ewmh->_NET_WM_STATE,
-        ewmh->_NET_WM_STATE_FULLSCREEN,
-    };
+    if(!ok || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
 
-    xcb_ewmh_set_supported(ewmh, default_screen, LENGTH(atoms), atoms);
-    xcb_ewmh_set_number_of_desktops(ewmh, default_screen, 1);
-    xcb_ewmh_set_current_desktop(ewmh, default_screen, 0);
+    return fd;
 }
 
-unsigned
-parse_boolean(const char *param, unsigned *data) {
-    if(streq(param, "toggle")) {
-        *data ^= 1;
-    } else if(streq(param, "false") || streq(param, "off")) {
-        *data = false;
-    } else if(streq(param, "true") || streq(param, "on")) {
-        *data = true;
-    } else {
-        return false;
+struct window *
+restore_window(struct monitor *monitor, const struct snapshot_window *record) {
+    struct window *window = malloc(sizeof(*window));
+
+    init_window(window, record->id);
+    select_window_events(record->id);
+
+    memcpy(window->class, record->class, sizeof(window->class));
+    memcpy(window->instance, record->instance, sizeof(window->instance));
+    window->class[sizeof(window->class) - 1] = 0;
+    window->instance[sizeof(window->instance) - 1] = 0;
+    window->properties.stale = 1 << PROPERTY_NAME;
+    window->hints = record->hints;
+    window->state = record->state;
+    window->urgent_hint = record->urgent_hint;
+    window->can_ping = record->can_ping;
+    window->urgent = record->urgent_hint || (record->state & STATE_ATTENTION);
+    window->has_color = record->has_color;
+    window->color = record->color;
+    window->floating = record->floating;
+    window->geometry = record->geometry;
+    window->shadow.geometry = record->server_geometry;
+    window->shadow.border_width = record->border_width;
+    window->shadow.border_color = ~0u;
+    window->shadow.mapped = true;
+
+    if(record->hidden) {
+        xcb_map_window(connection, window->id);
     }
 
-    return true;
-}
+    sync_create_alarm(window, record->counter);
 
-unsigned
-make_root() {
-    if(curmon->window_count < 2) return false;
-    node_make_head(&curmon->curwin->node, &curmon->windows);
-    arrange(curmon);
-    return true;
+    window->monitor = monitor;
+    monitor->window_count += 1;
+    node_append(&window->node, &monitor->windows);
+    seq_append(window_sequence(window), &window->position);
+
+    return window;
 }
 
-unsigned
-set_root_size(const char *param) {
-    if(curmon->window_count < 2) return false;
+// Restores the state written by write_snapshot() before a restart. Returns
+// false when there is no usable snapshot, in which case windows are adopted
+// from scratch.
+bool
+restore_snapshot(void) {
+    const char *env = getenv("MUON_SNAPSHOT");
+    int fd;
 
-    float cur = curmon->root_size;
-    float size;
+    if(!env || sscanf(env, "%d", &fd) != 1) return false;
 
-    if(!sscanf(param, "%f", &size)) return false;
+    unsetenv("MUON_SNAPSHOT");
 
-    if(param[0] == '+' || param[0] == '-') {
-        curmon->root_size += size;
-    } else {
-        curmon->root_size  = size;
-    }
+    struct snapshot_header header;
 
-    if(curmon->root_size > ROOT_MAX) curmon->root_size = ROOT_MAX;
-    if(curmon->root_size < ROOT_MIN) curmon->root_size = ROOT_MIN;
-    if(curmon->root_size == cur) return false;
+    if(!read_all(fd, &header, sizeof(header)) ||
+       header.magic != snapshot_template.magic ||
+       header.version != snapshot_template.version ||
+       memcmp(header.record_sizes, snapshot_template.record_sizes, sizeof(header.record_sizes))) {
+        p("ignoring snapshot -> missing or incompatible");
+        close(fd);
+        return false;
+    }
 
-    arrange(curmon);
+    // the counts size the allocations below, so a corrupt header stops here
+    if(header.rule_count > SNAPSHOT_RULES || header.macro_count > SNAPSHOT_MACROS ||
+       header.monitor_count > MAXMONITORS || header.window_count > SNAPSHOT_WINDOWS) {
+        p("ignoring snapshot -> %u rules, %u macros, %u monitors, %u windows", header.rule_count,
+            header.macro_count, header.monitor_count, header.window_count);
+        close(fd);
+        return false;
+    }
 
-    return true;
-}
+    struct snapshot_rule *rule_records = calloc(header.rule_count + 1, sizeof(*rule_records));
+    struct snapshot_macro *macro_records = calloc(header.macro_count + 1, sizeof(*macro_records));
+    struct snapshot_monitor *monitor_records = calloc(header.monitor_count + 1, sizeof(*monitor_records));
+    struct snapshot_window *window_records = calloc(header.window_count + 1, sizeof(*window_records));
+
+    bool ok =
+        read_all(fd, rule_records, header.rule_count * sizeof(*rule_records)) &&
+        read_all(fd, macro_records, header.macro_count * sizeof(*macro_records)) &&
+        read_all(fd, monitor_records, header.monitor_count * sizeof(*monitor_records)) &&
+        read_all(fd, window_records, header.window_count * sizeof(*window_records));
+
+    close(fd);
+
+    if(!ok) {
+        p("ignoring snapshot -> truncated");
+        free(rule_records);
+        free(macro_records);
+        free(monitor_records);
+        free(window_records);
+        return false;
+    }
 
-unsigned
-set_root_count(const char *param) {
-    if(curmon->window_count < 2) return false;
+    focus_mode = header.focus_mode;
+    fullscreen_hide = header.fullscreen_hide;
+    arrange_interval = header.arrange_interval;
+    focus_delay = header.focus_delay;
+    ping_timeout = header.ping_timeout;
+    stats_interval = header.stats_interval;
+
+    // timer_setup() ran with the defaults
+    if(stats_interval) schedule(&stats_timer, stats_interval);
+    else unschedule(&stats_timer);
+
+    for(unsigned i = 0; i < header.rule_count; i++) {
+        struct snapshot_rule *record = &rule_records[i];
+        record->name[sizeof(record->name) - 1] = 0;
+
+        struct rule *rule = make_rule(record->name);
+        rule->floating = record->floating;
+        rule->fullscreen = record->fullscreen;
+        rule->has_color = record->has_color;
+        rule->color = record->color;
+        node_append(&rule->node, &rules);
+    }
 
-    unsigned cur = curmon->root_count;
-    int count;
+    for(unsigned i = 0; i < header.macro_count; i++) {
+        struct command command = { .fd = -1 };
+        struct response reply;
 
-    if(!sscanf(param, "%u", &count)) return false;
+        memcpy(command.buffer, macro_records[i].definition, sizeof(command.buffer));
+        command.buffer[sizeof(command.buffer) - 1] = 0;
+        parse_command(&command);
+        command.arg = 2;
 
-    if(param[0] == '+' || param[0] == '-') {
-        curmon->root_count += count;
-    } else {
-        curmon->root_count  = count;
+        if(!define_macro(&command, reply.data)) p("dropping macro -> %s", reply.data);
     }
 
-    if(curmon->root_count > curmon->window_count) curmon->root_count = curmon->window_count;
-    if(curmon->root_count < 1) curmon->root_count = 1;
-    if(curmon->root_count == cur) return false;
+    // Snapshot monitors map onto current ones by output, then geometry,
+    // then nearest, since outputs may have changed across the restart.
+    struct monitor *candidates[MAXMONITORS], *monitor;
+    struct monitor *targets[header.monitor_count + 1];
+    unsigned n = 0;
 
-    arrange(curmon);
+    each_node_entry(monitor, &monitors, node) {
+        if(n < LENGTH(candidates)) candidates[n++] = monitor;
+    }
 
-    return true;
-}
+    for(unsigned i = 0; i < header.monitor_count; i++) {
+        struct snapshot_monitor *record = &monitor_records[i];
 
-unsigned
-shift_window(const char *param) {
-    if(curmon->window_count < 2) return false;
+        targets[i] = NULL;
 
-    int count;
+        for(unsigned j = 0; j < n && !targets[i]; j++) {
+            if(record->output && candidates[j]->output == record->output) targets[i] = candidates[j];
+        }
 
-    if(!sscanf(param, "%d", &count)) return false;
+        for(unsigned j = 0; j < n && !targets[i]; j++) {
+            if(!memcmp(&candidates[j]->base_geometry, &record->base_geometry, sizeof(struct geometry))) targets[i] = candidates[j];
+        }
 
-    for(unsigned i = 0; i < abs(count); i++) {
-        count < 0 ? node_unshift(&curmon->curwin->node, &curmon->windows)
-                  : node_shift(&curmon->curwin->node, &curmon->windows);
+        if(targets[i]) {
+            monitor = targets[i];
+            monitor->padding = record->padding;
+            monitor->root_count = record->root_count;
+            monitor->root_size = record->root_size;
+            monitor->mirror = record->mirror;
+            monitor->layout = record->layout;
+            monitor->border_width = record->border_width;
+            monitor->window_gap = record->window_gap;
+            memcpy(monitor->colors, record->colors, sizeof(monitor->colors));
+            resize_monitor(monitor);
+
+            if(i == header.curmon) curmon = monitor;
+        } else {
+            targets[i] = nearest_monitor(&record->base_geometry, candidates, n);
+        }
     }
 
-    arrange(curmon);
+    // X is only asked whether the windows still exist, all in one batch.
+    xcb_get_window_attributes_cookie_t cookies[header.window_count + 1];
 
-    return true;
-}
+    for(unsigned i = 0; i < header.window_count; i++) {
+        cookies[i] = xcb_get_window_attributes_unchecked(connection, window_records[i].id);
+    }
 
-unsigned
-select_window(const char *param) {
-    int id;
+    for(unsigned i = 0; i < header.window_count; i++) {
+        struct snapshot_window *record = &window_records[i];
+        xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(connection, cookies[i], NULL);
 
-    if(param[0] == '+' || param[0] == '-') {
-        if(!sscanf(param, "%d", &id)) return false;
+        bool alive = attr && !attr->override_redirect &&
+            (attr->map_state == XCB_MAP_STATE_VIEWABLE || record->hidden);
 
-        for(unsigned i = 0; i < abs(id); ++i) {
-            id < 0 ? focus(window_node(node_prev(&curmon->curwin->node, &curmon->windows)))
-                   : focus(window_node(node_next(&curmon->curwin->node, &curmon->windows)));
+        free(attr);
+
+        if(!alive || record->monitor >= header.monitor_count || find_window(record->id)) {
+            p("dropping window 0x%08x -> gone", record->id);
+            record->id = XCB_NONE;
+            continue;
         }
 
-        return true;
-    } else {
-        if(!sscanf(param, "%x", &id)) return false;
+        restore_window(targets[record->monitor], record);
+    }
 
-        struct monitor *monitor;
-        struct window *window;
+    for(unsigned i = 0; i < header.window_count; i++) {
+        struct snapshot_window *record = &window_records[i];
+        struct window *window, *parent;
 
-        if(id == curmon->curwin->id) return false;
+        if(!(window = find_window(record->id))) continue;
 
-        each_node_entry(monitor, &monitors, node) {
-            each_node_entry(window, &monitor->windows, node) {
-                if(window->id == id) {
-                    set_border_color(curmon->curwin, inactive_border_color);
-                    focus(window);
-                    return true;
-                }
-            }
+        if(record->transient && (parent = find_window(record->transient))) {
+            window->transient = parent;
+            node_append(&window->transient_node, &parent->transients);
         }
+    }
 
-        return false;
+    for(unsigned i = 0; i < header.monitor_count; i++) {
+        struct window *window = find_window(monitor_records[i].curwin);
+        if(window && window->monitor == targets[i]) targets[i]->curwin = window;
     }
-}
 
-void
-get_parameter(const char *name, char *response) {
-    if(streq(name, "root-size")) {
-        snprintf(response, BUFSIZ, "%f\n", curmon->root_size);
-    } else if(streq(name, "root-count")) {
-        snprintf(response, BUFSIZ, "%u\n", curmon->root_count);
-    } else if(streq(name, "window-gap")) {
-        snprintf(response, BUFSIZ, "%u\n", curmon->window_gap);
-    } else if(streq(name, "border-width")) {
-        snprintf(response, BUFSIZ, "%u\n", curmon->border_width);
-    } else if(streq(name, "fullscreen")) {
-        snprintf(response, BUFSIZ, "%s\n", curmon->fullscreen ? "true" : "false");
-    } else if(streq(name, "mirror")) {
-        snprintf(response, BUFSIZ, "%s\n", curmon->mirror ? "true" : "false");
+    for(unsigned i = 0; i < header.window_count; i++) {
+        struct window *window = find_window(window_records[i].id);
+        if(window && window_records[i].fullscreen && !window->monitor->fullscreen) toggle_fullscreen(window);
     }
-}
 
-struct rule *
-make_rule(const char *name) {
-    struct rule *rule = malloc(sizeof(*rule));
-    strncpy(rule->name, name, sizeof(rule->name));
-    rule->floating = false;
-    rule->fullscreen = false;
-    return rule;
+    p("restored %u rules, %u macros, %u monitors, %u windows from snapshot", header.rule_count, header.macro_count,
+        header.monitor_count, header.window_count);
+
+    free(rule_records);
+    free(macro_records);
+    free(monitor_records);
+    free(window_records);
+
+    for(unsigned i = 0; i < n; i++) {
+        arrange(candidates[i]);
+        update_border_colors(candidates[i]);
+    }
+
+    update_properties();
+    restack();
+    update_client_list();
+    focus(curmon->curwin);
+
+    return true;
 }
 
 void
-process_command(char *message, char *response) {
-    debug("command: %s", message);
+restart(char *argv[]) {
+    int fd = write_snapshot();
 
-    const char *command = strtok(message, " ");
-    if(!command) return;
+    if(fd < 0) {
+        p("warning: could not write snapshot, windows will be adopted from scratch");
+    } else {
+        char env[16];
+        snprintf(env, sizeof(env), "%d", fd);
+        setenv("MUON_SNAPSHOT", env, true);
+    }
 
-    if(streq(command, "quit")) {
-        running = false;
-    } else if(streq(command, "begin")) {
-        p("command sequence begin")
-        batch = true;
-        return;
-    } else if(streq(command, "end")) {
-        p("command sequence end")
-        batch = false;
-        arrange(curmon);
-    } else if(streq(command, "debug-window")) {
-        if(curmon->window_count < 1) return;
-        print_window(curmon->curwin);
-        return;
-    } else if(streq(command, "root-count")) {
-        if(curmon->window_count < 2) return;
-        const char *count = strtok(NULL, " ");
-        if(!count || !set_root_count(count)) return;
-    } else if(streq(command, "root-size")) {
-        if(curmon->window_count < 2) return;
-        const char *size = strtok(NULL, " ");
-        if(!size || !set_root_size(size)) return;
-    } else if(streq(command, "window-gap")) {
-        const char *gap = strtok(NULL, " ");
-        if(!gap) return;
-        sscanf(gap, "%u", &curmon->window_gap);
-        arrange(curmon);
-    } else if(streq(command, "border-width")) {
-        const char *size = strtok(NULL, " ");
-        if(!size) return;
-        sscanf(size, "%u", &curmon->border_width);
+    // The snapshot keeps tiles hidden behind a fullscreen window as hidden,
+    // but they are mapped again first: a new process that can't read it, or
+    // a failed exec, would otherwise never see them.
+    struct monitor *monitor;
 
-        struct window *window;
-        each_node_entry(window, &curmon->windows, node) {
-            set_border_width(window, curmon->border_width);
-        }
-
-        arrange(curmon);
-    } else if(streq(command, "padding")) {
-        const char *direction = strtok(NULL, " ");
-        if(!direction) return;
-
-        const char *padding = strtok(NULL, " ");
-        if(!padding) return;
-
-        if(streq(direction, "bottom")) {
-            sscanf(padding, "%u", &curmon->padding.h);
-        } else if(streq(direction, "top")) {
-            sscanf(padding, "%u", &curmon->padding.y);
-        } else if(streq(direction, "left")) {
-            sscanf(padding, "%u", &curmon->padding.x);
-        } else if(streq(direction, "right")) {
-            sscanf(padding, "%u", &curmon->padding.w);
-        } else {
-            return;
-        }
+    each_node_entry(monitor, &monitors, node) {
+        if(monitor->fullscreen) resume_tiles(monitor);
+    }
 
-        resize_monitor(curmon);
-        arrange(curmon);
-    } else if(streq(command, "fullscreen")) {
-        if(curmon->window_count < 1) return;
+    // An empty path still tells the new process not to start -t over the
+    // trace this one wrote or stopped.
+    setenv("MUON_TRACE", trace_file ? trace_path : "", true);
+    trace_stop();
 
-        const char *param = strtok(NULL, " ");
-        if(!param) return;
+    xcb_ewmh_connection_wipe(ewmh);
+    free(ewmh);
+    xcb_flush(connection);
+    xcb_disconnect(connection);
 
-        if(streq(param, "toggle")) {
-            toggle_fullscreen(curmon->curwin);
-        } else if(streq(param, "false") || streq(param, "off")) {
-            if(curmon->fullscreen) toggle_fullscreen(curmon->fullscreen);
-        } else if(streq(param, "true") || streq(param, "on")) {
-            if(!curmon->fullscreen) toggle_fullscreen(curmon->fullscreen);
-        } else {
-            return;
-        }
-    } else if(streq(command, "mirror")) {
-        if(curmon->fullscreen) return;
+    p("restart");
 
-        if(curmon->window_count < 2) return;
+    // argv[0] picks up a reinstalled binary; /proc/self/exe would still
+    // be the old one, but works when argv[0] can't be resolved
+    execvp(argv[0], argv);
+    execv("/proc/self/exe", argv);
 
-        const char *mirror = strtok(NULL, " ");
-        if(!mirror || !parse_boolean(mirror, &curmon->mirror)) return;
+    d("error: could not restart: %s", strerror(errno));
+}
 
-        arrange(curmon);
-    } else if(streq(command, "get")) {
-        const char *name = strtok(NULL, " ");
-        if(!name) return;
+void
+focus_expire(struct timer *timer) {
+    if(hover && focus_mode == FOCUS_POINTER) focus(hover);
+}
 
-        get_parameter(name, response);
+void
+stats_expire(struct timer *timer) {
+    p("stats: events %lu commands %lu merged %lu event-latency-avg %lluns event-latency-max %lluns",
+        stats.events, stats.commands, stats.merged,
+        stats.events ? stats.event_latency / stats.events : 0,
+        stats.event_latency_max);
 
-        return;
-    } else if(streq(command, "make-root")) {
-        if(curmon->fullscreen) return;
-        make_root();
-    } else if(streq(command, "select-window")) {
-        if(curmon->fullscreen) return;
+    if(stats_interval) schedule(timer, stats_interval);
+}
 
-        const char *param = strtok(NULL, " ");
-        if(!param) return;
+void
+timer_setup(void) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
 
-        select_window(param);
-    } else if(streq(command, "shift-window")) {
-        if(curmon->fullscreen) return;
+    if(timer_fd < 0) {
+        d("error: could not create timerfd");
+    }
 
-        const char *param = strtok(NULL, " ");
-        if(!param) return;
+    timer_init(&focus_timer, focus_expire);
+    timer_init(&stats_timer, stats_expire);
 
-        shift_window(param);
-    } else if(streq(command, "next-layout")) {
-        if(curmon->fullscreen) return;
+    if(stats_interval) schedule(&stats_timer, stats_interval);
+}
 
-        if(++curmon->layout >= LAYOUT_MAX) curmon->layout = 0;
+// Points the timerfd at the earliest deadline; only touched when it moves.
+void
+timers_arm(void) {
+    struct timer *first = timer_first(&timers);
+    unsigned long long deadline = first ? first->deadline : 0;
 
-        arrange(curmon);
-    } else if(streq(command, "previous-layout")) {
-        if(curmon->fullscreen) return;
+    if(deadline == timer_armed) return;
 
-        if(--curmon->layout <= 0) curmon->layout = LAYOUT_MAX;
+    struct itimerspec spec = {
+        .it_value = { deadline / 1000000000ULL, deadline % 1000000000ULL }
+    };
 
-        arrange(curmon);
-    } else if(streq(command, "reset-layout")) {
-        reset_layout(curmon);
+    // a zero value would disarm the timer instead of firing it
+    if(first && !deadline) spec.it_value.tv_nsec = 1;
 
-        arrange(curmon);
-    } else if(streq(command, "rule")) {
-        const char *name = strtok(NULL, " ");
-        if(!name) return;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    timer_armed = deadline;
+}
 
-        const char *attribute = strtok(NULL, " ");
-        if(!attribute) return;
+void
+timers_run(void) {
+    uint64_t expirations;
+    unsigned long long t = now();
+    struct timer *timer;
 
-        if(streq(attribute, "floating")) {
-            struct rule *rule = make_rule(name);
-            rule->floating = true;
-            node_append(&rule->node, &rules);
-            p("adding rule `floating' to `%s'", rule->name);
-        } else if(streq(attribute, "fullscreen")) {
-            struct rule *rule = make_rule(name);
-            rule->fullscreen = true;
-            node_append(&rule->node, &rules);
-            p("adding rule `fullscreen' to `%s'", rule->name);
-        }
+    // the count is unused, deadlines are checked against the heap
+    if(read(timer_fd, &expirations, sizeof(expirations)) < 0) expirations = 0;
 
-        return;
-    } else if(streq(command, "grab-pointer")) {
-        if(curmon->fullscreen) return;
+    timer_armed = 0;
 
-        const char *action = strtok(NULL, " ");
-        if(!action) return;
+    while((timer = timer_first(&timers)) && timer->deadline <= t) {
+        timer_stop(&timers, timer);
+        timer->callback(timer);
+    }
 
-        struct window *window;
-        if(!(window = query_pointer(&pointer->x, &pointer->y)))
-            return;
+    flush();
+}
 
-        p("grabbing pointer for -> 0x%08x, `%s'", window->id, window->name);
+void
+state_setup(void) {
+    int fd = open(state_path(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
 
-        if(streq(action, "move")) {
-            pointer->action = ACTION_MOVE;
-        } else if(streq(action, "resize")) {
-            pointer->action = ACTION_RESIZE;
-        } else {
-            return;
-        }
+    if(fd < 0 || !state_owned(fd) || ftruncate(fd, sizeof(*shared_state)) < 0) {
+        p("warning: could not create %s", state_path());
+        if(fd >= 0) close(fd);
+        return;
+    }
+
+    shared_state = mmap(NULL, sizeof(*shared_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(shared_state == MAP_FAILED) {
+        shared_state = NULL;
+        return;
+    }
 
-        if(!window->floating) {
-            float_window(window);
-            arrange(window->monitor);
-        }
+    if(shared_state->sequence & 1) shared_state->sequence++;
 
-        pointer->window = window;
-        pointer->geometry = window->geometry;;
+    state_write_begin(shared_state);
+    memset((char *) shared_state + offsetof(struct state, focused_window), 0,
+        sizeof(*shared_state) - offsetof(struct state, focused_window));
+    shared_state->magic = STATE_MAGIC;
+    shared_state->version = STATE_VERSION;
+    shared_state->size = sizeof(*shared_state);
+    state_write_end(shared_state);
+}
 
-        raise(window);
-        focus(window);
-    } else if(streq(command, "track-pointer")) {
-        const char *sx = strtok(NULL, " ");
-        const char *sy = strtok(NULL, " ");
-        unsigned dx, dy, x, y;
+// Called once per batch of events or commands. The page is rebuilt in a
+// scratch copy and only written, under the seqlock, when it changed.
+void
+publish_state(void) {
+    static struct state scratch;
+    struct monitor *monitor;
+    struct window *window;
+    unsigned m = 0;
 
-        if(!sx || !sy) return;
+    if(!shared_state) return;
 
-        sscanf(sx, "%u", &x);
-        sscanf(sy, "%u", &y);
+    memset(&scratch, 0, sizeof(scratch));
 
-        dx = x - pointer->x;
-        dy = y - pointer->y;
+    scratch.focused_window = curmon->curwin ? curmon->curwin->id : XCB_NONE;
+    scratch.focused_monitor = curmon->id;
 
-        move(pointer->window, pointer->geometry.x + dx, pointer->geometry.y + dy);
-    } else if(streq(command, "ungrab-pointer")) {
-        p("ungrabbing pointer");
+    each_node_entry(monitor, &monitors, node) {
+        if(m == STATE_MONITORS) break;
+
+        struct state_monitor *sm = &scratch.monitors[m++];
+        unsigned n = 0;
+
+        sm->id = monitor->id;
+        sm->x = monitor->base_geometry.x;
+        sm->y = monitor->base_geometry.y;
+        sm->w = monitor->base_geometry.w;
+        sm->h = monitor->base_geometry.h;
+        sm->layout = monitor->layout;
+        sm->root_count = monitor->root_count;
+        sm->root_size = monitor->root_size;
+        sm->mirror = monitor->mirror;
+        sm->window_gap = monitor->window_gap;
+        sm->border_width = monitor->border_width;
+        sm->focused = monitor->curwin ? monitor->curwin->id : XCB_NONE;
+
+        struct seq *sequences[] = { &monitor->tiles, &monitor->floats };
+
+        for(unsigned i = 0; i < LENGTH(sequences); i++) {
+            each_seq_entry(window, sequences[i], position) {
+                if(n == STATE_WINDOWS) break;
+
+                struct state_window *sw = &scratch.monitors[m - 1].windows[n++];
+
+                sw->id = window->id;
+                sw->flags =
+                    (window == monitor->curwin ? STATE_WINDOW_FOCUSED : 0) |
+                    (window->floating ? STATE_WINDOW_FLOATING : 0) |
+                    (window->fullscreen ? STATE_WINDOW_FULLSCREEN : 0) |
+                    (window->urgent ? STATE_WINDOW_URGENT : 0) |
+                    (window->hidden ? STATE_WINDOW_HIDDEN : 0);
+                sw->x = window->shadow.geometry.x;
+                sw->y = window->shadow.geometry.y;
+                sw->w = window->shadow.geometry.w;
+                sw->h = window->shadow.geometry.h;
+                strncpy(sw->class, window->class, sizeof(sw->class) - 1);
+            }
+        }
 
-        xcb_get_geometry_reply_t *geom = get_geometry(pointer->window->id);
+        sm->window_count = n;
+    }
 
-        pointer->window->geometry.x = geom->x;
-        pointer->window->geometry.y = geom->y;
-        pointer->window->geometry.w = geom->height;
-        pointer->window->geometry.h = geom->width;
+    scratch.monitor_count = m;
 
-        pointer->window = NULL;
-        pointer->action = ACTION_NONE;
-    } else if(streq(command, "close-window")) {
-        if(!curmon->curwin) return;
+    size_t offset = offsetof(struct state, focused_window);
 
-        delete_window(curmon->curwin);
-    } else if(streq(command, "focus-window")) {
-        struct window *window;
+    if(!memcmp((char *) shared_state + offset, (char *) &scratch + offset, sizeof(scratch) - offset)) return;
 
-        if(!(window = query_pointer(NULL, NULL))) return;
+    state_write_begin(shared_state);
+    memcpy((char *) shared_state + offset, (char *) &scratch + offset, sizeof(scratch) - offset);
+    state_write_end(shared_state);
+}
 
-        if(window == curmon->curwin) return;
+void
+cleanup(void) {
+    struct monitor *monitor, *m;
+    struct window *window, *w;
 
-        focus(window);
-    } else if(streq(command, "toggle-floating")) {
-        if(curmon->fullscreen) return;
+    deferring = true;
 
-        if(curmon->curwin) {
-            toggle_floating(curmon->curwin);
-            arrange(curmon);
-        }
-    } else {
-        snprintf(response, BUFSIZ, "unknown command: %s\n", command);
-        return;
+    each_node_entry_safe(monitor, m, &monitors, node) {
+        if(monitor->fullscreen)
+            resume_tiles(monitor);
+        each_node_entry_safe(window, w, &monitor->windows, node)
+            remove_window(window);
+        node_remove(&monitor->node);
+        free(monitor);
     }
 
-    flush();
+    deferring = false;
+    update_client_list();
 }
 
 void
-process_state(struct window *window, xcb_atom_t state, unsigned action) {
-    if(state == ewmh->_NET_WM_STATE_FULLSCREEN) {
-        p("  FULLSCREEN");
+ipc_close(struct pollfd *clients, unsigned *n, unsigned i) {
+    close(clients[i].fd);
+    clients[i] = clients[--*n];
+}
 
-        if(action == XCB_EWMH_WM_STATE_TOGGLE) {
-            p("   TOGGLE");
-            toggle_fullscreen(window);
-        } else if(action == XCB_EWMH_WM_STATE_REMOVE && window->fullscreen) {
-            p("   REMOVE");
-            toggle_fullscreen(window);
-        } else if(action == XCB_EWMH_WM_STATE_ADD && !window->fullscreen) {
-            p("   ADD");
-            toggle_fullscreen(window);
-        }
-    }
+// A reply that did not fit the socket buffer, written as the client drains it.
+struct stream {
+    char                *data;
+    size_t              length;
+    size_t              sent;
+};
 
-#define pstate(id) \
-    if(state == ewmh->_NET_WM_STATE_##id) { \
-        p("   "#id); \
-    } \
+// Client sockets are non-blocking, so a reader that stalls never holds up
+// the IPC thread. Returns whether the stream is done, sent or failed.
+bool
+send_stream(int fd, struct stream *stream) {
+    while(stream->sent < stream->length) {
+        ssize_t n = send(fd, stream->data + stream->sent, stream->length - stream->sent, MSG_NOSIGNAL);
 
-    pstate(MODAL);
-    pstate(STICKY);
-    pstate(MAXIMIZED_VERT);
-    pstate(MAXIMIZED_HORZ);
-    pstate(SHADED);
-    pstate(SKIP_TASKBAR);
-    pstate(SKIP_PAGER);
-    pstate(HIDDEN);
-    pstate(ABOVE);
-    pstate(BELOW);
-    pstate(DEMANDS_ATTENTION);
-}
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+        if(n <= 0) return true;
 
-void
-process_event(xcb_generic_event_t *event) {
-    switch (XCB_EVENT_RESPONSE_TYPE(event)) {
-        case XCB_MAP_REQUEST: {
-            xcb_map_request_event_t *e = (xcb_map_request_event_t *) event;
+        stream->sent += n;
+    }
 
-            pwinid("map-request", e->window);
+    return true;
+}
 
-            struct window *parent = find_window(e->parent);
-            if(parent) p("parent 0x%08x -> `%s'", parent->id, parent->name);
+/*
+ * fds holds the response eventfd and the listening socket, then the sockets
+ * with a stream still being written, then the clients a command is read
+ * from. Writers go first so they stay polled while the command ring is full.
+ */
+void *
+ipc_run(void *arg) {
+    int listen_fd = *(int *) arg;
+    struct pollfd fds[2 * MAXCLIENTS + 2];
+    struct pollfd *writers = fds + 2, *clients = writers;
+    struct stream streams[MAXCLIENTS];
+    unsigned n = 0, w = 0;
+
+    fds[0] = (struct pollfd) { .fd = response_event, .events = POLLIN };
+    fds[1] = (struct pollfd) { .fd = listen_fd, .events = POLLIN };
+
+    while(ring_load(&ipc_running)) {
+        unsigned full = ring_is_full(&commands);
+
+        fds[1].events = n < MAXCLIENTS ? POLLIN : 0;
+
+        if(poll(fds, full ? w + 2 : w + n + 2, -1) < 0) continue;
+
+        for(unsigned i = 0; i < w; i++) {
+            if(!writers[i].revents || !send_stream(writers[i].fd, &streams[i])) continue;
+
+            close(writers[i].fd);
+            free(streams[i].data);
+            streams[i] = streams[--w];
+            writers[i--] = writers[w];
+            writers[w] = writers[w + n];
+            clients = writers + w;
+        }
 
-            xcb_get_window_attributes_reply_t *attr = get_attributes(e->window);
-            unsigned override_redirect = attr->override_redirect;
-            free(attr);
+        if(fds[0].revents & POLLIN) {
+            eventfd_t value;
+            unsigned sent = 0;
+
+            eventfd_read(response_event, &value);
+
+            while(!ring_is_empty(&responses)) {
+                struct response *response = ring_front(&responses);
+                if(response->stream) {
+                    struct stream stream = { response->stream, response->length, 0 };
+
+                    if(send_stream(response->fd, &stream) || w == MAXCLIENTS) {
+                        free(stream.data);
+                        close(response->fd);
+                    } else {
+                        clients[n] = clients[0];
+                        streams[w] = stream;
+                        writers[w++] = (struct pollfd) { .fd = response->fd, .events = POLLOUT };
+                        clients = writers + w;
+                    }
+                } else {
+                    send(response->fd, response->data, strlen(response->data), MSG_NOSIGNAL);
+                    close(response->fd);
+                }
 
-            if(override_redirect) {
-                p("ignoring window 0x%08x -> override_redirect", e->window);
-                return;
+                ring_pop(&responses);
+                sent++;
             }
 
-            if(find_window(e->window)) {
-                p("ignoring window 0x%08x -> already managed", e->window);
-                return;
-            }
+            if(sent) eventfd_write(command_event, 1);
+        }
 
-            struct window *window = add_window(curmon, e->window);
-            xcb_map_window(connection, e->window);
+        if(fds[1].revents & POLLIN) {
+            int fd = accept4(listen_fd, NULL, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-            if(!window->floating) arrange(window->monitor);
+            if(fd >= 0) {
+                clients[n++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+            }
+        }
 
-            focus(window);
+        if(full) continue;
 
-            break;
-        }
+        for(unsigned i = 0; i < n && !ring_is_full(&commands); i++) {
+            if(!clients[i].revents) continue;
 
-        case XCB_MAP_NOTIFY: {
-            xcb_map_notify_event_t *e = (xcb_map_notify_event_t *) event;
+            struct command *command = ring_back(&commands);
+            ssize_t length = recv(clients[i].fd, command->buffer, sizeof(command->buffer) - 1, 0);
 
-            struct window *window;
+            if(length <= 0) {
+                ipc_close(clients, &n, i--);
+                continue;
+            }
 
-            if(!(window = find_window(e->window))) return;
+            command->buffer[length] = 0;
+            command->fd = clients[i].fd;
 
-            pwin("map-notify", window);
+            // `!' asks for no reply: the client is already gone
+            if(command->buffer[0] == '!') {
+                command->buffer[0] = ' ';
+                close(command->fd);
+                command->fd = -1;
+            }
 
-            break;
+            parse_command(command);
+            ring_push(&commands);
+            eventfd_write(command_event, 1);
+
+            clients[i--] = clients[--n];
         }
+    }
 
-        case XCB_DESTROY_NOTIFY: {
-            xcb_destroy_notify_event_t *e = (xcb_destroy_notify_event_t *) event;
+    while(n) ipc_close(clients, &n, 0);
 
-            struct window *window;
+    while(w) {
+        close(writers[--w].fd);
+        free(streams[w].data);
+    }
 
-            if(!(window = find_window(e->window))) return;
+    return NULL;
+}
 
-            pwin("destroy-notify", window);
+bool
+is_relative(const char *param) {
+    return param[0] == '+' || param[0] == '-';
+}
 
-            if(!remove_window(window)) return;
+/*
+ * Folds a queued command into the one right after it when only the later
+ * one needs to run: absolute settings just supersede each other. A later
+ * command that doesn't parse supersedes nothing, so both run. Relative
+ * root-size and root-count steps are clamped one at a time when they run,
+ * so a pair is resolved against the current value, with the same clamps,
+ * into the absolute value they would leave behind.
+ */
+bool
+coalesce(struct command *command, struct command *next) {
+    if(command->type != next->type || command->argc != 2 || next->argc != 2) return false;
 
-            break;
-        }
+    const char *a = command->argv[1], *b = next->argv[1];
 
-        case XCB_UNMAP_NOTIFY: {
-            xcb_unmap_notify_event_t *e = (xcb_unmap_notify_event_t *) event;
+    switch(command->type) {
+        case COMMAND_ROOT_SIZE: {
+            float x, y;
 
-            struct window *window;
+            if(sscanf(b, "%f", &y) != 1) return false;
+            if(!is_relative(b)) return true;
+            if(sscanf(a, "%f", &x) != 1) return false;
 
-            if(!(window = find_window(e->window))) return;
+            x = clamp_root_size(is_relative(a) ? curmon->root_size + x : x);
+            snprintf(next->scratch, sizeof(next->scratch), "%.9g", clamp_root_size(x + y));
+            next->argv[1] = next->scratch;
+            return true;
+        }
 
-            pwin("unmap-notify", window);
+        case COMMAND_ROOT_COUNT: {
+            int x, y;
 
-            if(!remove_window(window)) return;
+            if(sscanf(b, "%d", &y) != 1) return false;
+            if(!is_relative(b)) return true;
+            if(sscanf(a, "%d", &x) != 1) return false;
 
-            break;
+            x = clamp_root_count(is_relative(a) ? (int) curmon->root_count + x : x);
+            snprintf(next->scratch, sizeof(next->scratch), "%u", clamp_root_count(x + y));
+            next->argv[1] = next->scratch;
+            return true;
         }
 
-        case XCB_CLIENT_MESSAGE: {
-            xcb_client_message_event_t *e = (xcb_client_message_event_t *) event;
-
-            struct window *window;
+        case COMMAND_WINDOW_GAP:
+        case COMMAND_BORDER_WIDTH: {
+            unsigned x;
 
-            if(!(window = find_window(e->window))) return;
+            return sscanf(b, "%u", &x) == 1;
+        }
 
-            pwin("client-message", window);
+        default:
+            return false;
+    }
+}
 
-            if (e->type == ewmh->_NET_WM_STATE) {
-                p(" state");
+bool
+coalesce_track_pointer(struct command *command, struct command *next) {
+    // the first event after a grab anchors the pointer and can't be dropped
+    return command->type == COMMAND_TRACK_POINTER && next->type == COMMAND_TRACK_POINTER && pointer->anchored;
+}
 
-                process_state(window, e->data.data32[1], e->data.data32[0]);
-                process_state(window, e->data.data32[2], e->data.data32[0]);
-            }
+void
+arrange_deferred(void) {
+    struct monitor *monitor;
 
-            break;
-        }
+    each_node_entry(monitor, &monitors, node) {
+        if(monitor->deferred) arrange(monitor);
+    }
 
-        case XCB_CONFIGURE_NOTIFY: {
-            xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *) event;
+    if(client_list_changed) update_client_list();
+}
 
-            struct window *window;
+// Everything queued is handled as one batch: arranging is deferred to the
+// end, and the connection is flushed once.
+void
+process_commands(void) {
+    eventfd_t value;
+    unsigned processed = 0;
 
-            if(!(window = find_window(e->window))) return;
+    eventfd_read(command_event, &value);
 
-            if(pointer->window == window) {
-                debug("ignoring configure-notify for grabbed window");
-                return;
-            }
+    deferring = true;
 
-            p("configure-notify for 0x%08x -> `%s'", window->id, window->name);
+    while(!ring_is_empty(&commands) && !ring_is_full(&responses)) {
+        struct command *command = ring_front(&commands);
+        unsigned reply = command->fd >= 0;
+        static struct response discard;
 
-            break;
+        if(trace_file) {
+            trace_command(command);
         }
 
-        case XCB_CONFIGURE_REQUEST: {
-            xcb_configure_request_event_t *e = (xcb_configure_request_event_t *) event;
+        // reply-less commands write into a scratch response that is dropped
+        struct response *response = reply ? ring_back(&responses) : &discard;
 
-            struct window *window;
+        response->fd = command->fd;
+        response->data[0] = 0;
+        response->stream = NULL;
 
-            if(!(window = find_window(e->window))) return;
+        if(ring_count(&commands) > 1) {
+            struct command *next = ring_peek(&commands, 1);
 
-            if(pointer->window == window) {
-                debug("ignoring configure-request for grabbed window");
-                return;
+            if(coalesce_track_pointer(command, next) || coalesce(command, next)) {
+                debug("merged %s", command->argv[0]);
+                stats.merged += 1;
+                ring_pop(&commands);
+                if(reply) ring_push(&responses);
+                processed++;
+                continue;
             }
+        }
 
-            p("configure request for 0x%08x -> `%s'", window->id, window->name);
+        process_command(command, response);
 
-            if(window->floating) {
-                unsigned i = 0, mask = 0, values[7];
+        ring_pop(&commands);
 
-                if(e->value_mask & XCB_CONFIG_WINDOW_X) {
-                    mask |= XCB_CONFIG_WINDOW_X;
-                    values[i++] = e->x;
-                    window->geometry.x = e->x;
-                }
+        if(reply) {
+            ring_push(&responses);
+        } else {
+            free(discard.stream);
+        }
 
-                if(e->value_mask & XCB_CONFIG_WINDOW_Y) {
-                    mask |= XCB_CONFIG_WINDOW_Y;
-                    values[i++] = e->y;
-                    window->geometry.y = e->y;
-                }
+        processed++;
+    }
 
-                if(e->value_mask & XCB_CONFIG_WINDOW_WIDTH) {
-                    mask |= XCB_CONFIG_WINDOW_WIDTH;
-                    values[i++] = e->width;
-                    window->geometry.w = e->width;
-                }
+    deferring = false;
 
-                if(e->value_mask & XCB_CONFIG_WINDOW_HEIGHT) {
-                    mask |= XCB_CONFIG_WINDOW_HEIGHT;
-                    values[i++] = e->height;
-                    window->geometry.w = e->height;
-                }
+    if(!batch) {
+        arrange_deferred();
+        flush();
+    }
 
-                xcb_configure_window(connection, e->window, mask, values);
-            } else {
-                xcb_configure_notify_event_t config = {
-                    .response_type = XCB_CONFIGURE_NOTIFY,
-                    .event = window->id,
-                    .window = window->id,
-                    .above_sibling = XCB_NONE,
-                    .x = window->geometry.x,
-                    .y = window->geometry.y,
-                    .width = window->geometry.w,
-                    .height = window->geometry.h,
-                    .border_width = window->monitor->border_width,
-                    .override_redirect = false
-                };
+    if(processed) eventfd_write(response_event, 1);
+}
 
-                xcb_send_event(connection, false, window->id, XCB_EVENT_MASK_STRUCTURE_NOTIFY,
-                    (const char *) &config);
-            }
+// Starts with an event already taken from libxcb's queue, if any.
+void
+process_events(unsigned long long wake, xcb_generic_event_t *event) {
+    if(!event) event = xcb_poll_for_event(connection);
 
-            break;
+    for(; event; event = xcb_poll_for_event(connection)) {
+        if(trace_file) {
+            trace_write(TRACE_EVENT, event, TRACE_EVENT_SIZE);
         }
 
-        default: {
-            p("ignored event %d, %s", event->response_type, event_to_string(event->response_type));
+        process_event(event);
+        free(event);
 
-            return;
-         }
+        unsigned long long latency = now() - wake;
+        stats.events += 1;
+        stats.event_latency += latency;
+        if(latency > stats.event_latency_max) stats.event_latency_max = latency;
     }
 
-    flush();
+    if(!node_is_empty(&property_updates)) {
+        update_properties();
+    }
+
+    if(monitors_changed) {
+        reconcile_monitors();
+    }
 }
 
-void
-cleanup(void) {
-    struct monitor *monitor, *m;
-    struct window *window, *w;
+int
+ipc_setup(void) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
 
-    each_node_entry_safe(monitor, m, &monitors, node) {
-        each_node_entry_safe(window, w, &monitor->windows, node)
-            remove_window(window);
-        node_remove(&monitor->node);
-        free(monitor);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path());
+    unlink(addr.sun_path);
+    bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    listen(fd, SOMAXCONN);
+
+    command_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    response_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(command_event < 0 || response_event < 0) {
+        d("error: could not create eventfd");
     }
+
+    return fd;
 }
 
 int
-main(void) {
+main(int argc, char *argv[]) {
+    const char *trace = NULL;
+
+    for(int opt; (opt = getopt(argc, argv, "c:t:")) != -1; ) {
+        switch(opt) {
+            case 'c': config_path = optarg; break;
+            case 't': trace = optarg; break;
+            default: d("usage: muon [-c config] [-t trace]");
+        }
+    }
+
     p("x");
     connection = xcb_connect(NULL, &default_screen);
     screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
     w = screen->width_in_pixels;
     h = screen->height_in_pixels;
     root = screen->root;
-    inactive_border_color = parse_color(INACTIVE_COLOR);
-    active_border_color = parse_color(ACTIVE_COLOR);
+    visual_setup();
+    parse_color(ACTIVE_COLOR, &default_colors[COLOR_ACTIVE]);
+    parse_color(INACTIVE_COLOR, &default_colors[COLOR_INACTIVE]);
+    parse_color(FLOATING_COLOR, &default_colors[COLOR_FLOATING]);
+    parse_color(URGENT_COLOR, &default_colors[COLOR_URGENT]);
     wm_delete_window_atom = intern_atom("WM_DELETE_WINDOW");
     wm_protocols_atom = intern_atom("WM_PROTOCOLS");
     pointer = malloc(sizeof(*pointer));
     pointer->window = NULL;
+    pointer->action = ACTION_NONE;
+
+    for(unsigned i = 0; i < LENGTH(window_table); i++)
+        node_init(&window_table[i]);
 
     substructure();
+    randr_setup();
     monitor_setup();
     ewmh_setup();
+    sync_setup();
+    timer_setup();
+    geometry_setup();
+
+    const char *resumed = getenv("MUON_TRACE");
+
+    if(resumed) {
+        if(*resumed) trace_resume(resumed);
+        unsetenv("MUON_TRACE");
+    } else if(trace) {
+        trace_begin(trace);
+    }
+
+    unsigned long long start = now();
+
+    if(restore_snapshot()) {
+        p("restore took %lluus", (now() - start) / 1000);
+    } else if(config_path) {
+        load_config(config_path, false);
+    }
+
     reparent();
 
-    unsigned command_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    unsigned xcb_fd = xcb_get_file_descriptor(connection);
-    unsigned fdn = MAX(command_fd, xcb_fd) + 1;
+    state_setup();
+    publish_state();
+
+    int command_fd = ipc_setup();
+    int xcb_fd = xcb_get_file_descriptor(connection);
+    int fdn = MAX(MAX(command_event, xcb_fd), timer_fd) + 1;
     fd_set fds;
-    struct sockaddr_un addr;
 
-    addr.sun_family = AF_UNIX;
-    strcpy(addr.sun_path, "/tmp/muon-socket");
-    unlink(addr.sun_path);
-    bind(command_fd, (struct sockaddr *) &addr, sizeof(addr));
-    listen(command_fd, SOMAXCONN);
+    if(pthread_create(&ipc_thread, NULL, ipc_run, &command_fd)) {
+        d("error: could not start ipc thread");
+    }
 
     flush();
 
@@ -1506,36 +5870,64 @@ main(void) {
 
     while(running) {
         FD_ZERO(&fds);
-        FD_SET(command_fd, &fds);
+        FD_SET(command_event, &fds);
         FD_SET(xcb_fd, &fds);
+        FD_SET(timer_fd, &fds);
 
-        if(select(fdn, &fds, NULL, NULL, NULL)) {
-            if(FD_ISSET(command_fd, &fds)) {
-                unsigned n, return_fd = accept(command_fd, NULL, 0);
-                char res[BUFSIZ] = { 0 }, cmd[BUFSIZ] = { 0 };
+        // Events that arrived while a reply was awaited are already read
+        // into libxcb's queue, where select() on its descriptor never sees
+        // them.
+        xcb_generic_event_t *queued;
 
-                if(return_fd > 0 && (n = recv(return_fd, cmd, sizeof(cmd), 0)) > 0) {
-                    process_command(cmd, res);
-                    send(return_fd, res, strlen(res), 0);
-                    close(return_fd);
-                }
-            }
+        while((queued = xcb_poll_for_queued_event(connection))) {
+            process_events(now(), queued);
+            publish_state();
+        }
+
+        timers_arm();
+
+        int ready = select(fdn, &fds, NULL, NULL, NULL);
+
+        if(ready > 0) {
+            unsigned long long wake = now();
 
             if(FD_ISSET(xcb_fd, &fds)) {
-                xcb_generic_event_t *event;
+                process_events(wake, NULL);
+            }
 
-                while((event = xcb_poll_for_event(connection))) {
-                    process_event(event);
-                    free(event);
-                }
+            if(FD_ISSET(command_event, &fds)) {
+                process_commands();
+            }
+
+            if(FD_ISSET(timer_fd, &fds)) {
+                timers_run();
             }
 
+            publish_state();
         }
     }
 
-    cleanup();
+    ring_store(&ipc_running, false);
+    eventfd_write(response_event, 1);
+    pthread_join(ipc_thread, NULL);
 
     close(command_fd);
+    close(command_event);
+    close(response_event);
+
+    if(restarting) {
+        restart(argv);
+    }
+
+    cleanup();
+
+    if(shared_state) {
+        munmap(shared_state, sizeof(*shared_state));
+        unlink(state_path());
+    }
+
+    trace_stop();
+
     xcb_ewmh_connection_wipe(ewmh);
     free(ewmh);
     xcb_flush(connection);
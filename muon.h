@@ -5,14 +5,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_ewmh.h>
 #include <xcb/xcb_event.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xinerama.h>
+#include <xcb/sync.h>
+#include <xcb/randr.h>
 
 #define DEBUG false
 
@@ -22,25 +37,65 @@
 #define d(m, ...)               __p(m, exit(1), ##__VA_ARGS__);
 #define debug(m, ...)           if(DEBUG) p(m, ##__VA_ARGS__);
 #define pwinid(prefix, id)      printf(prefix " for 0x%08x\n", id)
-#define pwin(prefix, object)    printf(prefix " for 0x%08x -> `%s'\n", object->id, object->name)
+#define pwin(prefix, object)    printf(prefix " for 0x%08x -> `%s'\n", object->id, object->class)
 
 #define MAX(a, b)               ((a) > (b) ? (a) : (b))
+#define MIN(a, b)               ((a) < (b) ? (a) : (b))
 #define LENGTH(x)               (sizeof(x) / sizeof(*x))
 
 #define MAXLEN                  256
+#define MAXARGS                 64
+#define MAXCLIENTS              64
+#define MAXMONITORS             16
+#define QUEUE_SIZE              64
+#define WINDOW_TABLE_BITS       10
+#define WINDOW_TABLE_SIZE       (1 << WINDOW_TABLE_BITS)
+#define COLOR_CACHE_SIZE        32
+#define SOCKET_PATH             "/tmp/muon-socket"
+
+#define SNAPSHOT_MAGIC          0x6e6f756d
+#define SNAPSHOT_VERSION        4
+#define SNAPSHOT_RULES          4096
+#define SNAPSHOT_MACROS         1024
+#define SNAPSHOT_WINDOWS        65536
+
+#define GEOMETRY_FILE           ".cache/muon-geometry"
+#define GEOMETRY_MAGIC          0x6d6f6567
+#define GEOMETRY_VERSION        1
+#define GEOMETRY_SLOTS          128
+#define GEOMETRY_NAME           64
+#define GEOMETRY_SYNC           1000
+
+#define ARRANGE_INTERVAL        16
+#define FOCUS_DELAY             0
+#define PING_TIMEOUT            3000
+#define STATS_INTERVAL          0
+#define SYNC_TIMEOUT            100
 #define ROOT_MAX                0.9
 #define ROOT_MIN                0.1
 #define HORIZONTAL              0
 #define VERTICAL                1
 #define LAYOUT_MAX              2
+#define FOCUS_CLICK             0
+#define FOCUS_POINTER           1
 
 #define ROOT_COUNT              1
 #define ROOT_SIZE               0.65
 #define INACTIVE_COLOR          "#3F3E3B"
 #define ACTIVE_COLOR            "#11809E"
+#define FLOATING_COLOR          "#3F3E3B"
+#define URGENT_COLOR            "#9E3F11"
 #define MIRROR                  false
 #define WINDOW_GAP              1
 #define BORDER_WIDTH            5
+#define FOCUS_MODE              FOCUS_CLICK
+#define FULLSCREEN_HIDE         false
+
+// MUON_SOCKET moves the socket, e.g. for a test instance next to the real one.
+const char *socket_path(void) {
+    const char *path = getenv("MUON_SOCKET");
+    return path ? path : SOCKET_PATH;
+}
 
 const char *event_to_string(unsigned id) {
     switch(id) {
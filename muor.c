@@ -0,0 +1,327 @@
+#include "muon.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+ * Replays a muon trace against a running muon, normally on Xvfb. Events
+ * that clients cause are turned back into client requests on stand-in
+ * windows, built from the window records in the trace: map requests map
+ * them, configure requests configure them, destroy notifies destroy them
+ * and enter notifies warp the pointer into them. Events the server
+ * generates in response are left to the server. IPC commands are resent
+ * as reply-less commands.
+ */
+
+struct client {
+    uint32_t                    recorded;
+    xcb_window_t                id;
+    const struct trace_window   *window;
+};
+
+xcb_connection_t    *connection;
+xcb_window_t        root;
+xcb_atom_t          window_type_atom, dialog_atom;
+
+struct client       *clients;
+unsigned            client_count;
+
+unsigned long long
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+xcb_atom_t
+intern_atom(const char *name) {
+    xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection,
+        xcb_intern_atom_unchecked(connection, 0,
+            strlen(name), name), NULL);
+    xcb_atom_t atom = reply ? reply->atom : XCB_NONE;
+    free(reply);
+
+    return atom;
+}
+
+struct client *
+find_client(uint32_t recorded) {
+    for(unsigned i = 0; i < client_count; i++) {
+        if(clients[i].recorded == recorded) return &clients[i];
+    }
+
+    return NULL;
+}
+
+struct client *
+add_client(uint32_t recorded, const struct trace_window *window) {
+    struct client *client = find_client(recorded);
+
+    if(!client) {
+        clients = realloc(clients, (client_count + 1) * sizeof(*clients));
+        client = &clients[client_count++];
+        *client = (struct client) { recorded, XCB_NONE, NULL };
+    }
+
+    // the latest record wins if an id was reused
+    if(window) client->window = window;
+
+    return client;
+}
+
+void
+create_client(struct client *client) {
+    const struct trace_window *window = client->window;
+    struct trace_window fallback = { .w = 640, .h = 480 };
+
+    if(!window) window = &fallback;
+
+    client->id = xcb_generate_id(connection);
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, client->id, root,
+        window->x, window->y, MAX(window->w, 1), MAX(window->h, 1), 0,
+        XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT, 0, NULL);
+
+    char class[2 * TRACE_NAME + 2];
+    int length = snprintf(class, sizeof(class), "%.*s%c%.*s",
+        TRACE_NAME, window->instance, 0, TRACE_NAME, window->class);
+
+    xcb_change_property(connection, XCB_PROP_MODE_REPLACE, client->id,
+        XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8, length + 1, class);
+
+    struct client *parent = window->transient ? find_client(window->transient) : NULL;
+
+    if(parent && parent->id) {
+        xcb_change_property(connection, XCB_PROP_MODE_REPLACE, client->id,
+            XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 32, 1, &parent->id);
+    } else if(window->floating) {
+        // closest portable way to get a floating window without the rules
+        xcb_change_property(connection, XCB_PROP_MODE_REPLACE, client->id,
+            window_type_atom, XCB_ATOM_ATOM, 32, 1, &dialog_atom);
+    }
+}
+
+void
+replay_event(const uint8_t *data) {
+    struct client *client;
+
+    switch(data[0] & ~0x80) {
+        case XCB_MAP_REQUEST: {
+            const xcb_map_request_event_t *e = (const xcb_map_request_event_t *) data;
+
+            client = add_client(e->window, NULL);
+
+            if(!client->id) create_client(client);
+
+            xcb_map_window(connection, client->id);
+            break;
+        }
+
+        case XCB_CONFIGURE_REQUEST: {
+            const xcb_configure_request_event_t *e = (const xcb_configure_request_event_t *) data;
+            unsigned i = 0, mask = 0, values[5];
+
+            if(!(client = find_client(e->window)) || !client->id) return;
+
+            if(e->value_mask & XCB_CONFIG_WINDOW_X)             { mask |= XCB_CONFIG_WINDOW_X; values[i++] = e->x; }
+            if(e->value_mask & XCB_CONFIG_WINDOW_Y)             { mask |= XCB_CONFIG_WINDOW_Y; values[i++] = e->y; }
+            if(e->value_mask & XCB_CONFIG_WINDOW_WIDTH)         { mask |= XCB_CONFIG_WINDOW_WIDTH; values[i++] = e->width; }
+            if(e->value_mask & XCB_CONFIG_WINDOW_HEIGHT)        { mask |= XCB_CONFIG_WINDOW_HEIGHT; values[i++] = e->height; }
+            if(e->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)  { mask |= XCB_CONFIG_WINDOW_BORDER_WIDTH; values[i++] = e->border_width; }
+
+            if(mask) xcb_configure_window(connection, client->id, mask, values);
+            break;
+        }
+
+        case XCB_DESTROY_NOTIFY: {
+            const xcb_destroy_notify_event_t *e = (const xcb_destroy_notify_event_t *) data;
+
+            if(!(client = find_client(e->window)) || !client->id) return;
+
+            xcb_destroy_window(connection, client->id);
+            client->id = XCB_NONE;
+            break;
+        }
+
+        case XCB_ENTER_NOTIFY: {
+            const xcb_enter_notify_event_t *e = (const xcb_enter_notify_event_t *) data;
+
+            if(!(client = find_client(e->event)) || !client->id) return;
+
+            xcb_warp_pointer(connection, XCB_NONE, client->id, 0, 0, 0, 0, 1, 1);
+            break;
+        }
+
+        case XCB_PROPERTY_NOTIFY: {
+            const xcb_property_notify_event_t *e = (const xcb_property_notify_event_t *) data;
+
+            if(e->atom != XCB_ATOM_WM_NAME) return;
+            if(!(client = find_client(e->window)) || !client->id) return;
+
+            char name[32];
+            int length = snprintf(name, sizeof(name), "replay %u", e->time);
+
+            xcb_change_property(connection, XCB_PROP_MODE_REPLACE, client->id,
+                XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, length, name);
+            break;
+        }
+    }
+}
+
+int
+send_command(const char *text, unsigned length, bool reply) {
+    char cmd[BUFSIZ];
+    unsigned o = 0;
+
+    if(!reply) cmd[o++] = '!';
+
+    if(o + length >= sizeof(cmd)) return -1;
+
+    memcpy(cmd + o, text, length);
+    o += length;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path());
+
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    send(fd, cmd, o, 0);
+
+    if(!reply) {
+        close(fd);
+        return 0;
+    }
+
+    char res[BUFSIZ];
+    ssize_t r;
+    while((r = recv(fd, res, sizeof(res), 0)) > 0)
+        fwrite(res, 1, r, stdout);
+
+    close(fd);
+
+    return 0;
+}
+
+bool
+skip_command(const char *text, unsigned length) {
+    static const char *skipped[] = { "restart", "trace" };
+
+    for(unsigned i = 0; i < LENGTH(skipped); i++) {
+        unsigned n = strlen(skipped[i]);
+        if(length >= n && !memcmp(text, skipped[i], n) && (length == n || text[n] == ' ')) return true;
+    }
+
+    return false;
+}
+
+void
+sync_server(void) {
+    free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+}
+
+int
+main(int argc, char *argv[]) {
+    bool fast = false;
+
+    for(int opt; (opt = getopt(argc, argv, "f")) != -1; ) {
+        switch(opt) {
+            case 'f': fast = true; break;
+            default: d("usage: muor [-f] trace");
+        }
+    }
+
+    if(optind >= argc) d("usage: muor [-f] trace");
+
+    int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if(fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct trace_header)) {
+        d("error: could not read %s", argv[optind]);
+    }
+
+    const uint8_t *trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const uint8_t *end = trace + st.st_size;
+    close(fd);
+
+    if(trace == MAP_FAILED) d("error: could not map %s", argv[optind]);
+
+    const struct trace_header *header = (const struct trace_header *) trace;
+
+    if(header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+        d("error: %s is not a version %u trace", argv[optind], TRACE_VERSION);
+    }
+
+    connection = xcb_connect(NULL, NULL);
+
+    if(xcb_connection_has_error(connection)) d("error: could not connect to X");
+
+    root = xcb_setup_roots_iterator(xcb_get_setup(connection)).data->root;
+    window_type_atom = intern_atom("_NET_WM_WINDOW_TYPE");
+    dialog_atom = intern_atom("_NET_WM_WINDOW_TYPE_DIALOG");
+
+    // window records come after the map request they belong to, so the
+    // stand-in windows are described up front
+    const uint8_t *start = trace + sizeof(*header), *o;
+    const struct trace_record *record;
+
+    for(o = start; o + sizeof(*record) <= end; o += sizeof(*record) + record->length) {
+        record = (const struct trace_record *) o;
+
+        if(o + sizeof(*record) + record->length > end) break;
+
+        if(record->type == TRACE_WINDOW && record->length >= sizeof(struct trace_window)) {
+            const struct trace_window *window = (const void *) (o + sizeof(*record));
+            add_client(window->id, window);
+        }
+    }
+
+    unsigned long events = 0, commands = 0;
+    unsigned long long begin = now();
+
+    for(o = start; o + sizeof(*record) <= end; o += sizeof(*record) + record->length) {
+        record = (const struct trace_record *) o;
+        const uint8_t *data = o + sizeof(*record);
+
+        if(data + record->length > end) break;
+
+        if(!fast) {
+            unsigned long long due = begin + record->time, t = now();
+
+            if(due > t) {
+                xcb_flush(connection);
+                struct timespec ts = { (due - t) / 1000000000ULL, (due - t) % 1000000000ULL };
+                nanosleep(&ts, NULL);
+            }
+        }
+
+        if(record->type == TRACE_EVENT && record->length >= TRACE_EVENT_SIZE) {
+            replay_event(data);
+            events++;
+        } else if(record->type == TRACE_COMMAND && !skip_command((const char *) data, record->length)) {
+            // X requests issued so far must reach muon before the command
+            sync_server();
+            send_command((const char *) data, record->length, false);
+            commands++;
+        }
+    }
+
+    sync_server();
+
+    double elapsed = (now() - begin) / 1e9;
+
+    printf("replayed %lu events and %lu commands on %u windows in %.3fs\n", events, commands, client_count, elapsed);
+
+    // let muon drain what is queued before reading its counters
+    usleep(100000);
+    send_command("get stats", 9, true);
+
+    xcb_disconnect(connection);
+    munmap((void *) trace, st.st_size);
+
+    return 0;
+}
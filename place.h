@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * Free-space placement. Obstacles are added as rectangles, then place_find()
+ * looks for the tallest free gap a w*h rectangle fits in. Only x positions
+ * flush against an area or obstacle edge can start a new gap, so those are
+ * the candidates; for each, the obstacles crossing that column are reduced
+ * to sorted y intervals and swept for gaps. With n obstacles that is
+ * O(n^2 log n) per placement and no allocation once the buffers have grown.
+ */
+
+struct place_rect {
+    int x, y, w, h;
+};
+
+struct place_span {
+    int start, end;
+};
+
+struct place {
+    struct place_rect *rects;
+    struct place_span *spans;
+    int *columns;
+    unsigned count, capacity;
+};
+
+static inline int __place_compare_int(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+static inline int __place_compare_span(const void *a, const void *b) {
+    const struct place_span *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static inline int __place_abs(int x) {
+    return x < 0 ? -x : x;
+}
+
+static inline int __place_min(int x, int y) {
+    return x < y ? x : y;
+}
+
+static inline void place_reset(struct place *place) {
+    place->count = 0;
+}
+
+static inline void place_add(struct place *place, struct place_rect rect) {
+    if(rect.w <= 0 || rect.h <= 0) return;
+
+    if(place->count == place->capacity) {
+        place->capacity = place->capacity ? place->capacity * 2 : 16;
+        place->rects = realloc(place->rects, place->capacity * sizeof(*place->rects));
+        place->spans = realloc(place->spans, place->capacity * sizeof(*place->spans));
+        place->columns = realloc(place->columns, (2 * place->capacity + 2) * sizeof(*place->columns));
+    }
+
+    place->rects[place->count++] = rect;
+}
+
+static inline void place_free(struct place *place) {
+    free(place->rects);
+    free(place->spans);
+    free(place->columns);
+    *place = (struct place) { 0 };
+}
+
+// Finds a position for a w*h rectangle inside area. Returns false if every
+// position overlaps an obstacle, in which case the tallest gap is used.
+static inline bool place_find(struct place *place, const struct place_rect *area, int w, int h, int *x, int *y) {
+    unsigned columns = 0;
+    int best_gap = -1, best_distance = 0;
+
+    if(w > area->w) w = area->w;
+    if(h > area->h) h = area->h;
+
+    int right = area->x + area->w - w;
+
+    int center_x = area->x + (area->w - w) / 2;
+    int center_y = area->y + (area->h - h) / 2;
+
+    *x = center_x;
+    *y = center_y;
+
+    if(!place->count) return true;
+
+    int *column = place->columns;
+    column[columns++] = area->x;
+    column[columns++] = right;
+
+    for(unsigned i = 0; i < place->count; i++) {
+        const struct place_rect *r = &place->rects[i];
+        int after = r->x + r->w, before = r->x - w;
+
+        if(after >= area->x && after <= right) column[columns++] = after;
+        if(before >= area->x && before <= right) column[columns++] = before;
+    }
+
+    qsort(column, columns, sizeof(*column), __place_compare_int);
+
+    for(unsigned c = 0; c < columns; c++) {
+        if(c && column[c] == column[c - 1]) continue;
+
+        int cx = column[c];
+        unsigned spans = 0;
+
+        for(unsigned i = 0; i < place->count; i++) {
+            const struct place_rect *r = &place->rects[i];
+
+            if(r->x < cx + w && r->x + r->w > cx) {
+                place->spans[spans++] = (struct place_span) { r->y, r->y + r->h };
+            }
+        }
+
+        qsort(place->spans, spans, sizeof(*place->spans), __place_compare_span);
+
+        int top = area->y, bottom = area->y + area->h;
+
+        for(unsigned i = 0; i <= spans; i++) {
+            int end = i < spans ? __place_min(place->spans[i].start, bottom) : bottom;
+
+            if(end > top) {
+                int gap = end - top;
+                int gy = gap >= h ? top + (gap - h) / 2 : __place_min(top, bottom - h);
+                int distance = __place_abs(cx - center_x) + __place_abs(gy - center_y);
+
+                if(gap > best_gap || (gap == best_gap && distance < best_distance)) {
+                    best_gap = gap;
+                    best_distance = distance;
+                    *x = cx;
+                    *y = gy;
+                }
+            }
+
+            if(i < spans && place->spans[i].end > top) top = place->spans[i].end;
+        }
+    }
+
+    return best_gap >= h;
+}
@@ -0,0 +1,31 @@
+#include <stdbool.h>
+
+/*
+ * Single-producer/single-consumer ring buffer. The slot count must be a
+ * power of two. The producer owns head, the consumer owns tail; each side
+ * only ever stores its own index, so no locking is needed.
+ */
+
+#define RING(type, n) struct { \
+    unsigned head __attribute__((aligned(64))); \
+    unsigned tail __attribute__((aligned(64))); \
+    type slots[n]; \
+}
+
+#define ring_load(ptr)          __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define ring_store(ptr, value)  __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+#define ring_capacity(ring)     (sizeof((ring)->slots) / sizeof(*(ring)->slots))
+#define ring_slot(ring, i)      (&(ring)->slots[(i) & (ring_capacity(ring) - 1)])
+
+/* producer */
+#define ring_is_full(ring)      ((ring)->head - ring_load(&(ring)->tail) == ring_capacity(ring))
+#define ring_back(ring)         ring_slot(ring, (ring)->head)
+#define ring_push(ring)         ring_store(&(ring)->head, (ring)->head + 1)
+
+/* consumer */
+#define ring_is_empty(ring)     (ring_load(&(ring)->head) == (ring)->tail)
+#define ring_front(ring)        ring_slot(ring, (ring)->tail)
+#define ring_pop(ring)          ring_store(&(ring)->tail, (ring)->tail + 1)
+#define ring_count(ring)        (ring_load(&(ring)->head) - (ring)->tail)
+#define ring_peek(ring, i)      ring_slot(ring, (ring)->tail + (i))
@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * Index-addressable sequence, implemented as an implicit treap. Nodes are
+ * embedded in their owner like struct node, ordered by position rather
+ * than by key. Lookup by index, insertion, removal and finding a node's
+ * index are all O(log n); stepping to a neighbour is amortized O(1).
+ */
+
+#define seq_entry(ptr, type, member) ((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
+
+struct seq_node {
+    struct seq_node *parent, *left, *right;
+    unsigned size, priority;
+};
+
+struct seq {
+    struct seq_node *root;
+};
+
+static inline unsigned __seq_random(void) {
+    static unsigned state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static inline unsigned __seq_size(const struct seq_node *node) {
+    return node ? node->size : 0;
+}
+
+static inline struct seq_node *__seq_update(struct seq_node *node) {
+    node->size = 1 + __seq_size(node->left) + __seq_size(node->right);
+    if(node->left) node->left->parent = node;
+    if(node->right) node->right->parent = node;
+    return node;
+}
+
+static inline void __seq_split(struct seq_node *node, unsigned index, struct seq_node **left, struct seq_node **right) {
+    if(!node) {
+        *left = *right = NULL;
+        return;
+    }
+
+    node->parent = NULL;
+
+    if(__seq_size(node->left) < index) {
+        __seq_split(node->right, index - __seq_size(node->left) - 1, &node->right, right);
+        *left = __seq_update(node);
+    } else {
+        __seq_split(node->left, index, left, &node->left);
+        *right = __seq_update(node);
+    }
+}
+
+static inline struct seq_node *__seq_merge(struct seq_node *left, struct seq_node *right) {
+    if(!left) return right;
+    if(!right) return left;
+
+    if(left->priority > right->priority) {
+        left->right = __seq_merge(left->right, right);
+        return __seq_update(left);
+    }
+
+    right->left = __seq_merge(left, right->left);
+    return __seq_update(right);
+}
+
+static inline void __seq_set_root(struct seq *seq, struct seq_node *root) {
+    seq->root = root;
+    if(root) root->parent = NULL;
+}
+
+static inline void seq_init(struct seq *seq) {
+    seq->root = NULL;
+}
+
+static inline unsigned seq_size(const struct seq *seq) {
+    return __seq_size(seq->root);
+}
+
+static inline bool seq_is_empty(const struct seq *seq) {
+    return seq->root == NULL;
+}
+
+static inline unsigned seq_index(const struct seq_node *node) {
+    unsigned index = __seq_size(node->left);
+
+    for(; node->parent; node = node->parent) {
+        if(node->parent->right == node) {
+            index += __seq_size(node->parent->left) + 1;
+        }
+    }
+
+    return index;
+}
+
+static inline struct seq_node *seq_at(const struct seq *seq, unsigned index) {
+    struct seq_node *node = seq->root;
+
+    while(node) {
+        unsigned left = __seq_size(node->left);
+        if(index < left) {
+            node = node->left;
+        } else if(index > left) {
+            index -= left + 1;
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+
+    return node;
+}
+
+static inline void seq_insert_at(struct seq *seq, struct seq_node *node, unsigned index) {
+    struct seq_node *left, *right;
+
+    node->parent = node->left = node->right = NULL;
+    node->size = 1;
+    node->priority = __seq_random();
+
+    __seq_split(seq->root, index, &left, &right);
+    __seq_set_root(seq, __seq_merge(__seq_merge(left, node), right));
+}
+
+static inline void seq_append(struct seq *seq, struct seq_node *node) {
+    seq_insert_at(seq, node, seq_size(seq));
+}
+
+static inline void seq_remove(struct seq *seq, struct seq_node *node) {
+    struct seq_node *left, *middle, *right;
+
+    __seq_split(seq->root, seq_index(node), &left, &right);
+    __seq_split(right, 1, &middle, &right);
+    __seq_set_root(seq, __seq_merge(left, right));
+}
+
+static inline void seq_move(struct seq *seq, struct seq_node *node, unsigned index) {
+    seq_remove(seq, node);
+    seq_insert_at(seq, node, index);
+}
+
+static inline void seq_splice(struct seq *seq, struct seq *other) {
+    __seq_set_root(seq, __seq_merge(seq->root, other->root));
+    other->root = NULL;
+}
+
+static inline struct seq_node *seq_first(const struct seq *seq) {
+    struct seq_node *node = seq->root;
+    if(node) while(node->left) node = node->left;
+    return node;
+}
+
+static inline struct seq_node *seq_next(struct seq_node *node) {
+    if(node->right) {
+        for(node = node->right; node->left; node = node->left);
+        return node;
+    }
+
+    while(node->parent && node->parent->right == node) node = node->parent;
+    return node->parent;
+}
+
+#define each_seq_entry(pos, seq, member) \
+    for(struct seq_node *__n = seq_first(seq); \
+        __n && ((pos = seq_entry(__n, __typeof__(*pos), member)), true); \
+        __n = seq_next(__n))
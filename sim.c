@@ -0,0 +1,1436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xcb_ewmh.h>
+#include <xcb/xcb_icccm.h>
+#include <xcb/xinerama.h>
+#include <xcb/sync.h>
+#include <xcb/randr.h>
+
+/*
+ * Simulated X server for stress runs. It is linked into muon in place of
+ * libxcb and the xcb-util libraries, so the backend interface is exactly
+ * the set of xcb calls muon makes and the production build pays nothing
+ * for it. The server keeps geometry, map state, stacking, focus and the
+ * client properties muon reads for every window; requests apply at once
+ * and queue the notify events a real server would send. Extensions are
+ * reported absent.
+ *
+ * When its event queue is empty the server plays the clients: it maps,
+ * configures, renames, flags, fullscreens, enters and destroys windows at
+ * random, deterministically for a given seed. After the requested number
+ * of events it checks muon's view against its own, reports throughput and
+ * memory growth on stderr and stops muon; a failed check makes muon exit
+ * with status 1. muon still opens its socket, state page and geometry
+ * store, so a run next to a live muon needs its own HOME, MUON_SOCKET and
+ * MUON_STATE, as make stress sets them.
+ *
+ * MUON_SIM_EVENTS     client events to generate (1000000)
+ * MUON_SIM_WINDOWS    live windows at most (5000)
+ * MUON_SIM_LATENCY    microseconds added to every reply (0)
+ * MUON_SIM_CHECK      also check every this many events (0, only at the end)
+ * MUON_SIM_SEED       random seed (1)
+ * MUON_SIM_RATE       client events per second, 0 for as fast as muon reads
+ *                     them (0); paced runs report how late muon read each one
+ */
+
+#define SIM_ROOT            0x00000100
+#define SIM_BASE            0x00400000
+#define SIM_IDS             0x00800000
+#define SIM_WIDTH           1920
+#define SIM_HEIGHT          1080
+#define SIM_REQUESTS        (1 << 16)
+#define SIM_ATOMS           64
+#define SIM_SAMPLES         10
+#define SIM_BURST           64
+#define SIM_NAME            256
+
+enum sim_protocols {
+    SIM_DELETE      = 1 << 0,
+    SIM_PING        = 1 << 1
+};
+
+struct sim_window {
+    xcb_window_t        id;
+    int                 x, y;
+    unsigned            w, h, border;
+    unsigned            exists;
+    unsigned            mapped;
+    unsigned            managed;
+    unsigned            urgent;
+    unsigned            dialog;
+    unsigned            fullscreen;
+    unsigned            protocols;
+    unsigned            min_w, min_h;
+    unsigned            name;
+    unsigned            class;
+    xcb_window_t        transient;
+    int                 above, below;
+    unsigned            live;
+};
+
+struct sim {
+    unsigned long       target;
+    unsigned            max_windows;
+    unsigned            latency;
+    unsigned long       check_interval;
+    unsigned            seed;
+    unsigned            rate;
+
+    int                 fd;
+    unsigned            sequence;
+    uint32_t            requests[SIM_REQUESTS];
+    xcb_window_t        next_id;
+    xcb_window_t        focus;
+    unsigned            client_list;
+
+    struct sim_window   *windows;
+    unsigned            window_count, window_capacity;
+    unsigned            *free, free_count;
+    unsigned            *live, live_count;
+    int                 top, bottom;
+
+    xcb_generic_event_t **queue;
+    unsigned            queue_head, queue_tail, queue_capacity;
+
+    char                *atoms[SIM_ATOMS];
+    unsigned            atom_count;
+
+    unsigned long       generated, delivered, replies;
+    unsigned            burst;
+    unsigned long       sample_at;
+    unsigned long       rss[SIM_SAMPLES + 1];
+    unsigned            samples;
+    unsigned long long  start;
+    unsigned            *lateness;
+    unsigned            failures;
+    unsigned            done;
+} sim;
+
+static const char *sim_classes[][2] = {
+    { "urxvt", "URxvt" },
+    { "navigator", "Firefox" },
+    { "pavucontrol", "Pavucontrol" },
+    { "gcalctool", "Gcalctool" },
+    { "emacs", "Emacs" },
+    { "mpv", "mpv" },
+    { "zathura", "Zathura" },
+    { "gimp", "Gimp" },
+};
+
+static xcb_screen_t sim_screen;
+static xcb_setup_t sim_server;
+static xcb_query_extension_reply_t sim_absent;
+static xcb_intern_atom_cookie_t sim_ewmh_cookies[1];
+
+xcb_extension_t xcb_randr_id = { "RANDR", 0 };
+xcb_extension_t xcb_sync_id = { "SYNC", 0 };
+xcb_extension_t xcb_xinerama_id = { "XINERAMA", 0 };
+
+xcb_atom_t wm_delete_atom, ping_atom, state_atom, fullscreen_atom, dialog_atom, name_atom;
+
+/* muon */
+extern unsigned running;
+struct window *find_window(xcb_window_t);
+void check_shadow(char *);
+
+unsigned
+sim_random(void) {
+    sim.seed ^= sim.seed << 13;
+    sim.seed ^= sim.seed >> 17;
+    sim.seed ^= sim.seed << 5;
+    return sim.seed;
+}
+
+unsigned long long
+sim_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long
+sim_rss(void) {
+    unsigned long size = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if(statm) {
+        if(fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+unsigned long
+sim_env(const char *name, unsigned long fallback) {
+    const char *value = getenv(name);
+    return value ? strtoul(value, NULL, 10) : fallback;
+}
+
+// Every reply pays the configured round trip.
+void
+sim_reply(void) {
+    sim.replies++;
+
+    if(!sim.latency) return;
+
+    unsigned long long until = sim_now() + sim.latency * 1000ULL;
+    while(sim_now() < until);
+}
+
+unsigned
+sim_request(uint32_t value) {
+    sim.sequence++;
+    sim.requests[sim.sequence & (SIM_REQUESTS - 1)] = value;
+    return sim.sequence;
+}
+
+uint32_t
+sim_cookie(unsigned sequence) {
+    return sim.requests[sequence & (SIM_REQUESTS - 1)];
+}
+
+struct sim_window *
+sim_window(xcb_window_t id) {
+    if(id < SIM_BASE || id >= SIM_BASE + sim.window_count) return NULL;
+
+    struct sim_window *window = &sim.windows[id - SIM_BASE];
+
+    return window->exists ? window : NULL;
+}
+
+xcb_atom_t
+sim_atom(const char *name) {
+    for(unsigned i = 0; i < sim.atom_count; i++) {
+        if(!strcmp(sim.atoms[i], name)) return 0x100 + i;
+    }
+
+    if(sim.atom_count == SIM_ATOMS) {
+        fprintf(stderr, "sim: out of atoms\n");
+        exit(1);
+    }
+
+    sim.atoms[sim.atom_count] = strdup(name);
+
+    return 0x100 + sim.atom_count++;
+}
+
+/* events */
+
+xcb_generic_event_t *
+sim_event(uint8_t type) {
+    xcb_generic_event_t *event = calloc(1, sizeof(*event));
+    event->response_type = type;
+    return event;
+}
+
+// Events carry the last request processed, so the ones a request causes
+// carry its own sequence number.
+void
+sim_queue(void *event) {
+    if(sim.queue_tail - sim.queue_head == sim.queue_capacity) {
+        unsigned capacity = sim.queue_capacity ? sim.queue_capacity * 2 : 1024;
+        xcb_generic_event_t **queue = malloc(capacity * sizeof(*queue));
+
+        for(unsigned i = 0; i < sim.queue_capacity; i++) {
+            queue[i] = sim.queue[(sim.queue_head + i) & (sim.queue_capacity - 1)];
+        }
+
+        free(sim.queue);
+        sim.queue = queue;
+        sim.queue_tail -= sim.queue_head;
+        sim.queue_head = 0;
+        sim.queue_capacity = capacity;
+    }
+
+    ((xcb_generic_event_t *) event)->full_sequence = sim.sequence;
+    sim.queue[sim.queue_tail++ & (sim.queue_capacity - 1)] = event;
+}
+
+void
+sim_map_notify(struct sim_window *window) {
+    xcb_map_notify_event_t *e = (void *) sim_event(XCB_MAP_NOTIFY);
+    e->event = SIM_ROOT;
+    e->window = window->id;
+    sim_queue(e);
+}
+
+void
+sim_unmap_notify(struct sim_window *window, unsigned synthetic) {
+    xcb_unmap_notify_event_t *e = (void *) sim_event(XCB_UNMAP_NOTIFY | (synthetic ? 0x80 : 0));
+    e->event = SIM_ROOT;
+    e->window = window->id;
+    sim_queue(e);
+}
+
+void
+sim_configure_notify(struct sim_window *window) {
+    xcb_configure_notify_event_t *e = (void *) sim_event(XCB_CONFIGURE_NOTIFY);
+    e->event = SIM_ROOT;
+    e->window = window->id;
+    e->above_sibling = window->below >= 0 ? sim.windows[window->below].id : XCB_NONE;
+    e->x = window->x;
+    e->y = window->y;
+    e->width = window->w;
+    e->height = window->h;
+    e->border_width = window->border;
+    sim_queue(e);
+}
+
+/* stacking, a doubly linked list from bottom to top by window index */
+
+void
+sim_unstack(struct sim_window *window) {
+    if(window->below >= 0) sim.windows[window->below].above = window->above;
+    else sim.bottom = window->above;
+
+    if(window->above >= 0) sim.windows[window->above].below = window->below;
+    else sim.top = window->below;
+
+    window->above = window->below = -1;
+}
+
+// Stacks window directly above sibling, or at the bottom without one.
+void
+sim_stack_above(struct sim_window *window, struct sim_window *sibling) {
+    int index = window - sim.windows;
+
+    if(!sibling) {
+        window->above = sim.bottom;
+        if(sim.bottom >= 0) sim.windows[sim.bottom].below = index;
+        else sim.top = index;
+        sim.bottom = index;
+        return;
+    }
+
+    int sibling_index = sibling - sim.windows;
+
+    window->below = sibling_index;
+    window->above = sibling->above;
+
+    if(sibling->above >= 0) sim.windows[sibling->above].below = index;
+    else sim.top = index;
+
+    sibling->above = index;
+}
+
+void
+sim_restack(struct sim_window *window, struct sim_window *sibling, unsigned mode) {
+    if(sibling == window) return;
+
+    sim_unstack(window);
+
+    if(mode == XCB_STACK_MODE_ABOVE) {
+        sim_stack_above(window, sibling ? sibling : sim.top >= 0 ? &sim.windows[sim.top] : NULL);
+    } else if(mode == XCB_STACK_MODE_BELOW) {
+        sim_stack_above(window, sibling ? (sibling->below >= 0 ? &sim.windows[sibling->below] : NULL) : NULL);
+    } else {
+        sim_stack_above(window, sim.top >= 0 ? &sim.windows[sim.top] : NULL);
+    }
+}
+
+/* clients */
+
+struct sim_window *
+sim_pick(unsigned managed) {
+    if(!sim.live_count) return NULL;
+
+    for(unsigned tries = 0; tries < 8; tries++) {
+        struct sim_window *window = &sim.windows[sim.live[sim_random() % sim.live_count]];
+        if(window->managed == managed) return window;
+    }
+
+    return NULL;
+}
+
+void
+sim_create(void) {
+    unsigned index;
+
+    if(sim.free_count) {
+        index = sim.free[--sim.free_count];
+    } else {
+        if(sim.window_count == sim.window_capacity) {
+            sim.window_capacity = sim.window_capacity ? sim.window_capacity * 2 : 1024;
+            sim.windows = realloc(sim.windows, sim.window_capacity * sizeof(*sim.windows));
+            sim.free = realloc(sim.free, sim.window_capacity * sizeof(*sim.free));
+            sim.live = realloc(sim.live, sim.window_capacity * sizeof(*sim.live));
+        }
+
+        index = sim.window_count++;
+    }
+
+    struct sim_window *window = &sim.windows[index];
+    struct sim_window *parent = sim_random() % 20 ? NULL : sim_pick(true);
+
+    *window = (struct sim_window) {
+        .id = SIM_BASE + index,
+        .x = sim_random() % (SIM_WIDTH / 2),
+        .y = sim_random() % (SIM_HEIGHT / 2),
+        .w = 100 + sim_random() % 700,
+        .h = 100 + sim_random() % 500,
+        .exists = true,
+        .managed = true,
+        .dialog = sim_random() % 10 == 0,
+        .protocols = SIM_DELETE | (sim_random() % 2 ? SIM_PING : 0),
+        .class = sim_random() % (sizeof(sim_classes) / sizeof(*sim_classes)),
+        .transient = parent ? parent->id : XCB_NONE,
+        .above = -1,
+        .below = -1,
+        .live = sim.live_count,
+    };
+
+    if(sim_random() % 10 == 0) {
+        window->min_w = 200;
+        window->min_h = 150;
+    }
+
+    sim.live[sim.live_count++] = index;
+    sim_stack_above(window, sim.top >= 0 ? &sim.windows[sim.top] : NULL);
+
+    xcb_map_request_event_t *e = (void *) sim_event(XCB_MAP_REQUEST);
+    e->parent = SIM_ROOT;
+    e->window = window->id;
+    sim_queue(e);
+}
+
+void
+sim_destroy(struct sim_window *window) {
+    unsigned index = window - sim.windows;
+
+    if(window->mapped) {
+        window->mapped = false;
+        sim_unmap_notify(window, false);
+    }
+
+    xcb_destroy_notify_event_t *e = (void *) sim_event(XCB_DESTROY_NOTIFY);
+    e->event = SIM_ROOT;
+    e->window = window->id;
+    sim_queue(e);
+
+    if(sim.focus == window->id) sim.focus = SIM_ROOT;
+
+    sim_unstack(window);
+
+    sim.live[window->live] = sim.live[--sim.live_count];
+    sim.windows[sim.live[window->live]].live = window->live;
+
+    window->exists = false;
+    sim.free[sim.free_count++] = index;
+}
+
+// Unmapping a window muon already hid changes nothing on the server, so
+// per ICCCM the client announces the withdrawal with a synthetic unmap.
+void
+sim_withdraw(struct sim_window *window) {
+    window->managed = false;
+
+    if(window->mapped) {
+        window->mapped = false;
+        sim_unmap_notify(window, false);
+    } else {
+        sim_unmap_notify(window, true);
+    }
+}
+
+void
+sim_remap(struct sim_window *window) {
+    window->managed = true;
+
+    xcb_map_request_event_t *e = (void *) sim_event(XCB_MAP_REQUEST);
+    e->parent = SIM_ROOT;
+    e->window = window->id;
+    sim_queue(e);
+}
+
+void
+sim_configure_request(struct sim_window *window) {
+    xcb_configure_request_event_t *e = (void *) sim_event(XCB_CONFIGURE_REQUEST);
+    e->parent = SIM_ROOT;
+    e->window = window->id;
+    e->value_mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+    e->x = sim_random() % (SIM_WIDTH / 2);
+    e->y = sim_random() % (SIM_HEIGHT / 2);
+    e->width = 100 + sim_random() % 700;
+    e->height = 100 + sim_random() % 500;
+    sim_queue(e);
+}
+
+void
+sim_enter(struct sim_window *window) {
+    xcb_enter_notify_event_t *e = (void *) sim_event(XCB_ENTER_NOTIFY);
+    e->root = SIM_ROOT;
+    e->event = window->id;
+    e->root_x = window->x + window->w / 2;
+    e->root_y = window->y + window->h / 2;
+    e->mode = XCB_NOTIFY_MODE_NORMAL;
+    e->detail = XCB_NOTIFY_DETAIL_NONLINEAR;
+    sim_queue(e);
+}
+
+void
+sim_property(struct sim_window *window) {
+    xcb_property_notify_event_t *e = (void *) sim_event(XCB_PROPERTY_NOTIFY);
+    e->window = window->id;
+    e->state = XCB_PROPERTY_NEW_VALUE;
+
+    if(sim_random() % 2) {
+        window->name++;
+        e->atom = name_atom;
+    } else {
+        window->urgent ^= 1;
+        e->atom = XCB_ATOM_WM_HINTS;
+    }
+
+    sim_queue(e);
+}
+
+void
+sim_fullscreen(struct sim_window *window) {
+    xcb_client_message_event_t *e = (void *) sim_event(XCB_CLIENT_MESSAGE);
+    e->format = 32;
+    e->window = window->id;
+    e->type = state_atom;
+    e->data.data32[0] = XCB_EWMH_WM_STATE_TOGGLE;
+    e->data.data32[1] = fullscreen_atom;
+    sim_queue(e);
+}
+
+// One random client action; some draws find nothing to act on.
+void
+sim_step(void) {
+    unsigned r = sim_random() % 100;
+    struct sim_window *window;
+
+    if(r < 20) {
+        if(sim.live_count < sim.max_windows) sim_create();
+    } else if(r < 30) {
+        if((window = sim_pick(true))) sim_destroy(window);
+    } else if(r < 33) {
+        if((window = sim_pick(true))) sim_withdraw(window);
+    } else if(r < 36) {
+        if((window = sim_pick(false))) sim_remap(window);
+        else if((window = sim_pick(true))) sim_destroy(window);
+    } else if(r < 55) {
+        if((window = sim_pick(true))) sim_configure_request(window);
+    } else if(r < 75) {
+        if((window = sim_pick(true)) && window->mapped) sim_enter(window);
+    } else if(r < 95) {
+        if((window = sim_pick(true))) sim_property(window);
+    } else {
+        if((window = sim_pick(true))) sim_fullscreen(window);
+    }
+}
+
+/* checks */
+
+void
+sim_check(void) {
+    char response[BUFSIZ] = { 0 };
+    unsigned windows = 0, inconsistent = 0, missing = 0, managed = 0;
+
+    check_shadow(response);
+
+    char *summary = strstr(response, " inconsistent\n");
+
+    if(summary) {
+        while(summary > response && summary[-1] != '\n') summary--;
+        sscanf(summary, "%u windows, %u inconsistent", &windows, &inconsistent);
+    } else if(response[0]) {
+        inconsistent = ~0u;
+    }
+
+    for(unsigned i = 0; i < sim.live_count; i++) {
+        struct sim_window *window = &sim.windows[sim.live[i]];
+
+        if(!window->managed) continue;
+
+        managed++;
+
+        if(!find_window(window->id)) {
+            if(missing++ < 8) fprintf(stderr, "sim: 0x%08x not managed\n", window->id);
+        }
+    }
+
+    if(inconsistent) {
+        fprintf(stderr, "%s", response);
+    }
+
+    if(sim.client_list != managed) {
+        fprintf(stderr, "sim: client list has %u windows, %u expected\n", sim.client_list, managed);
+    }
+
+    fprintf(stderr, "sim: check after %lu events: %u windows, %u inconsistent, %u not managed\n",
+        sim.generated, windows, inconsistent, missing);
+
+    if(inconsistent || missing || sim.client_list != managed) sim.failures++;
+}
+
+int
+sim_compare(const void *a, const void *b) {
+    unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+    return x < y ? -1 : x > y;
+}
+
+void
+sim_report(void) {
+    double elapsed = (sim_now() - sim.start) / 1e9;
+
+    fprintf(stderr, "sim: %lu client events, %lu delivered in %.2fs, %.0f events/s, %lu replies\n",
+        sim.generated, sim.delivered, elapsed, sim.delivered / elapsed, sim.replies);
+
+    if(sim.rate && sim.generated) {
+        unsigned *l = sim.lateness;
+
+        qsort(l, sim.generated, sizeof(*l), sim_compare);
+        fprintf(stderr, "sim: event latency at %u events/s: p50 %uus p99 %uus p99.9 %uus max %uus\n", sim.rate,
+            l[sim.generated / 2], l[sim.generated * 99 / 100], l[sim.generated * 999 / 1000], l[sim.generated - 1]);
+    }
+
+    fprintf(stderr, "sim: rss kB");
+    for(unsigned i = 0; i < sim.samples; i++) fprintf(stderr, " %lu", sim.rss[i]);
+    fprintf(stderr, "\n");
+}
+
+void
+sim_setup(void) {
+    sim.target = sim_env("MUON_SIM_EVENTS", 1000000);
+    sim.max_windows = sim_env("MUON_SIM_WINDOWS", 5000);
+    sim.latency = sim_env("MUON_SIM_LATENCY", 0);
+    sim.check_interval = sim_env("MUON_SIM_CHECK", 0);
+    sim.seed = sim_env("MUON_SIM_SEED", 1) ?: 1;
+    sim.rate = sim_env("MUON_SIM_RATE", 0);
+    sim.lateness = sim.rate ? malloc(sim.target * sizeof(*sim.lateness)) : NULL;
+    sim.next_id = SIM_IDS;
+    sim.focus = SIM_ROOT;
+    sim.top = sim.bottom = -1;
+    sim.sample_at = sim.target / SIM_SAMPLES ?: 1;
+
+    // muon waits on this fd; it stays readable, the queue decides
+    sim.fd = eventfd(1, EFD_CLOEXEC);
+
+    sim_screen.root = SIM_ROOT;
+    sim_screen.width_in_pixels = SIM_WIDTH;
+    sim_screen.height_in_pixels = SIM_HEIGHT;
+    sim_screen.root_depth = 24;
+
+    wm_delete_atom = sim_atom("WM_DELETE_WINDOW");
+    ping_atom = sim_atom("_NET_WM_PING");
+    state_atom = sim_atom("_NET_WM_STATE");
+    fullscreen_atom = sim_atom("_NET_WM_STATE_FULLSCREEN");
+    dialog_atom = sim_atom("_NET_WM_WINDOW_TYPE_DIALOG");
+    name_atom = sim_atom("_NET_WM_NAME");
+
+    fprintf(stderr, "sim: %lu events, %u windows, %uus latency, seed %u\n",
+        sim.target, sim.max_windows, sim.latency, sim.seed);
+}
+
+/* core protocol */
+
+xcb_connection_t *
+xcb_connect(const char *display, int *screen) {
+    sim_setup();
+
+    if(screen) *screen = 0;
+
+    return (xcb_connection_t *) &sim;
+}
+
+void
+xcb_disconnect(xcb_connection_t *c) {
+    if(sim.failures) exit(1);
+}
+
+const xcb_setup_t *
+xcb_get_setup(xcb_connection_t *c) {
+    return &sim_server;
+}
+
+xcb_screen_iterator_t
+xcb_setup_roots_iterator(const xcb_setup_t *R) {
+    return (xcb_screen_iterator_t) { &sim_screen, 1, 0 };
+}
+
+xcb_depth_iterator_t
+xcb_screen_allowed_depths_iterator(const xcb_screen_t *R) {
+    return (xcb_depth_iterator_t) { NULL, 0, 0 };
+}
+
+void
+xcb_depth_next(xcb_depth_iterator_t *i) {
+    i->rem = 0;
+}
+
+xcb_visualtype_iterator_t
+xcb_depth_visuals_iterator(const xcb_depth_t *R) {
+    return (xcb_visualtype_iterator_t) { NULL, 0, 0 };
+}
+
+void
+xcb_visualtype_next(xcb_visualtype_iterator_t *i) {
+    i->rem = 0;
+}
+
+int
+xcb_get_file_descriptor(xcb_connection_t *c) {
+    return sim.fd;
+}
+
+xcb_void_cookie_t
+xcb_no_operation(xcb_connection_t *c) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+int
+xcb_flush(xcb_connection_t *c) {
+    return 1;
+}
+
+uint32_t
+xcb_generate_id(xcb_connection_t *c) {
+    return sim.next_id++;
+}
+
+const xcb_query_extension_reply_t *
+xcb_get_extension_data(xcb_connection_t *c, xcb_extension_t *ext) {
+    return &sim_absent;
+}
+
+xcb_generic_error_t *
+xcb_request_check(xcb_connection_t *c, xcb_void_cookie_t cookie) {
+    sim_reply();
+    return NULL;
+}
+
+void
+xcb_discard_reply(xcb_connection_t *c, unsigned int sequence) {
+}
+
+xcb_generic_event_t *
+xcb_poll_for_event(xcb_connection_t *c) {
+    if(sim.done) return NULL;
+
+    if(!sim.start) sim.start = sim_now();
+
+    while(sim.queue_head == sim.queue_tail) {
+        // let muon's loop run its commands and timers between bursts
+        if(sim.burst == SIM_BURST) {
+            sim.burst = 0;
+            return NULL;
+        }
+
+        if(sim.check_interval && sim.generated && sim.generated % sim.check_interval == 0) {
+            sim_check();
+        }
+
+        if(sim.generated >= sim.target) {
+            sim.rss[sim.samples++] = sim_rss();
+            sim_report();
+            sim_check();
+            sim.done = true;
+            running = false;
+            return NULL;
+        }
+
+        if(sim.generated % sim.sample_at == 0 && sim.samples < SIM_SAMPLES) {
+            sim.rss[sim.samples++] = sim_rss();
+        }
+
+        // A paced event is due at a fixed time; a real server would have
+        // queued it then, so the wait until muon asks is its latency.
+        if(sim.rate) {
+            unsigned long long due = sim.start + sim.generated * 1000000000ULL / sim.rate, now = sim_now();
+
+            if(now < due) {
+                sim.burst = 0;
+                return NULL;
+            }
+
+            sim.lateness[sim.generated] = (now - due) / 1000;
+        }
+
+        sim.generated++;
+        sim.burst++;
+        sim_step();
+    }
+
+    sim.delivered++;
+
+    return sim.queue[sim.queue_head++ & (sim.queue_capacity - 1)];
+}
+
+// Only what a step already queued, without generating more.
+xcb_generic_event_t *
+xcb_poll_for_queued_event(xcb_connection_t *c) {
+    if(sim.done || sim.queue_head == sim.queue_tail) return NULL;
+
+    sim.delivered++;
+
+    return sim.queue[sim.queue_head++ & (sim.queue_capacity - 1)];
+}
+
+xcb_void_cookie_t
+xcb_change_window_attributes(xcb_connection_t *c, xcb_window_t window, uint32_t value_mask, const void *value_list) {
+    return (xcb_void_cookie_t) { sim_request(window) };
+}
+
+xcb_void_cookie_t
+xcb_change_window_attributes_checked(xcb_connection_t *c, xcb_window_t window, uint32_t value_mask, const void *value_list) {
+    return (xcb_void_cookie_t) { sim_request(window) };
+}
+
+// Applied all or nothing, like the server, which rejects a zero size.
+xcb_void_cookie_t
+xcb_configure_window(xcb_connection_t *c, xcb_window_t id, uint16_t value_mask, const void *value_list) {
+    unsigned sequence = sim_request(id);
+    struct sim_window *window = sim_window(id);
+    const uint32_t *values = value_list;
+    struct sim_window next;
+    struct sim_window *sibling = NULL;
+    unsigned mode = ~0u;
+
+    if(!window) return (xcb_void_cookie_t) { sequence };
+
+    next = *window;
+
+    if(value_mask & XCB_CONFIG_WINDOW_X) next.x = (int16_t) *values++;
+    if(value_mask & XCB_CONFIG_WINDOW_Y) next.y = (int16_t) *values++;
+    if(value_mask & XCB_CONFIG_WINDOW_WIDTH) next.w = (uint16_t) *values++;
+    if(value_mask & XCB_CONFIG_WINDOW_HEIGHT) next.h = (uint16_t) *values++;
+    if(value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) next.border = (uint16_t) *values++;
+    if(value_mask & XCB_CONFIG_WINDOW_SIBLING) sibling = sim_window(*values++);
+    if(value_mask & XCB_CONFIG_WINDOW_STACK_MODE) mode = *values++;
+
+    if(!next.w || !next.h) return (xcb_void_cookie_t) { sequence };
+
+    window->x = next.x;
+    window->y = next.y;
+    window->w = next.w;
+    window->h = next.h;
+    window->border = next.border;
+
+    if(mode != ~0u) sim_restack(window, sibling, mode);
+
+    sim_configure_notify(window);
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+xcb_void_cookie_t
+xcb_map_window(xcb_connection_t *c, xcb_window_t id) {
+    unsigned sequence = sim_request(id);
+    struct sim_window *window = sim_window(id);
+
+    if(window && !window->mapped) {
+        window->mapped = true;
+        sim_map_notify(window);
+    }
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+xcb_void_cookie_t
+xcb_unmap_window(xcb_connection_t *c, xcb_window_t id) {
+    unsigned sequence = sim_request(id);
+    struct sim_window *window = sim_window(id);
+
+    if(window && window->mapped) {
+        window->mapped = false;
+        sim_unmap_notify(window, false);
+    }
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+xcb_void_cookie_t
+xcb_set_input_focus(xcb_connection_t *c, uint8_t revert_to, xcb_window_t focus, xcb_timestamp_t time) {
+    unsigned sequence = sim_request(focus);
+    struct sim_window *window = sim_window(focus);
+
+    if(focus != sim.focus && (window || focus == SIM_ROOT)) {
+        sim.focus = focus;
+
+        if(window) {
+            xcb_focus_in_event_t *e = (void *) sim_event(XCB_FOCUS_IN);
+            e->event = focus;
+            e->mode = XCB_NOTIFY_MODE_NORMAL;
+            e->detail = XCB_NOTIFY_DETAIL_NONLINEAR;
+            sim_queue(e);
+        }
+    }
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+// Clients honour WM_DELETE_WINDOW and answer pings.
+xcb_void_cookie_t
+xcb_send_event(xcb_connection_t *c, uint8_t propagate, xcb_window_t destination, uint32_t event_mask, const char *event) {
+    unsigned sequence = sim_request(destination);
+    const xcb_client_message_event_t *message = (const void *) event;
+    struct sim_window *window = sim_window(destination);
+
+    if(window && (event[0] & 0x7f) == XCB_CLIENT_MESSAGE) {
+        if(message->data.data32[0] == wm_delete_atom && (window->protocols & SIM_DELETE)) {
+            sim_destroy(window);
+        } else if(message->data.data32[0] == ping_atom && (window->protocols & SIM_PING)) {
+            xcb_client_message_event_t *pong = (void *) sim_event(XCB_CLIENT_MESSAGE);
+            *pong = *message;
+            pong->window = SIM_ROOT;
+            sim_queue(pong);
+        }
+    }
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+xcb_void_cookie_t
+xcb_kill_client(xcb_connection_t *c, uint32_t resource) {
+    unsigned sequence = sim_request(resource);
+    struct sim_window *window = sim_window(resource);
+
+    if(window) sim_destroy(window);
+
+    return (xcb_void_cookie_t) { sequence };
+}
+
+xcb_intern_atom_cookie_t
+xcb_intern_atom_unchecked(xcb_connection_t *c, uint8_t only_if_exists, uint16_t name_len, const char *name) {
+    char atom[SIM_NAME];
+    snprintf(atom, sizeof(atom), "%.*s", name_len, name);
+    return (xcb_intern_atom_cookie_t) { sim_request(sim_atom(atom)) };
+}
+
+xcb_intern_atom_reply_t *
+xcb_intern_atom_reply(xcb_connection_t *c, xcb_intern_atom_cookie_t cookie, xcb_generic_error_t **e) {
+    xcb_intern_atom_reply_t *reply = calloc(1, sizeof(*reply));
+    sim_reply();
+    reply->atom = sim_cookie(cookie.sequence);
+    return reply;
+}
+
+xcb_get_geometry_cookie_t
+xcb_get_geometry(xcb_connection_t *c, xcb_drawable_t drawable) {
+    return (xcb_get_geometry_cookie_t) { sim_request(drawable) };
+}
+
+xcb_get_geometry_reply_t *
+xcb_get_geometry_reply(xcb_connection_t *c, xcb_get_geometry_cookie_t cookie, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return NULL;
+
+    xcb_get_geometry_reply_t *reply = calloc(1, sizeof(*reply));
+    reply->root = SIM_ROOT;
+    reply->x = window->x;
+    reply->y = window->y;
+    reply->width = window->w;
+    reply->height = window->h;
+    reply->border_width = window->border;
+
+    return reply;
+}
+
+xcb_get_window_attributes_cookie_t
+xcb_get_window_attributes(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_window_attributes_cookie_t) { sim_request(window) };
+}
+
+xcb_get_window_attributes_cookie_t
+xcb_get_window_attributes_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_window_attributes_cookie_t) { sim_request(window) };
+}
+
+xcb_get_window_attributes_reply_t *
+xcb_get_window_attributes_reply(xcb_connection_t *c, xcb_get_window_attributes_cookie_t cookie, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return NULL;
+
+    xcb_get_window_attributes_reply_t *reply = calloc(1, sizeof(*reply));
+    reply->map_state = window->mapped ? XCB_MAP_STATE_VIEWABLE : XCB_MAP_STATE_UNMAPPED;
+
+    return reply;
+}
+
+xcb_query_tree_cookie_t
+xcb_query_tree(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_query_tree_cookie_t) { sim_request(window) };
+}
+
+xcb_query_tree_reply_t *
+xcb_query_tree_reply(xcb_connection_t *c, xcb_query_tree_cookie_t cookie, xcb_generic_error_t **e) {
+    sim_reply();
+    return calloc(1, sizeof(xcb_query_tree_reply_t));
+}
+
+xcb_window_t *
+xcb_query_tree_children(const xcb_query_tree_reply_t *R) {
+    return (xcb_window_t *) (R + 1);
+}
+
+int
+xcb_query_tree_children_length(const xcb_query_tree_reply_t *R) {
+    return R->children_len;
+}
+
+xcb_alloc_color_cookie_t
+xcb_alloc_color(xcb_connection_t *c, xcb_colormap_t cmap, uint16_t red, uint16_t green, uint16_t blue) {
+    return (xcb_alloc_color_cookie_t) { sim_request((red >> 8) << 16 | (green >> 8) << 8 | blue >> 8) };
+}
+
+xcb_alloc_color_reply_t *
+xcb_alloc_color_reply(xcb_connection_t *c, xcb_alloc_color_cookie_t cookie, xcb_generic_error_t **e) {
+    xcb_alloc_color_reply_t *reply = calloc(1, sizeof(*reply));
+    sim_reply();
+    reply->pixel = sim_cookie(cookie.sequence);
+    return reply;
+}
+
+xcb_void_cookie_t
+xcb_free_colors(xcb_connection_t *c, xcb_colormap_t cmap, uint32_t plane_mask, uint32_t pixels_len, const uint32_t *pixels) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+/* extensions, all absent */
+
+xcb_randr_query_version_cookie_t
+xcb_randr_query_version(xcb_connection_t *c, uint32_t major_version, uint32_t minor_version) {
+    return (xcb_randr_query_version_cookie_t) { sim_request(0) };
+}
+
+xcb_randr_query_version_reply_t *
+xcb_randr_query_version_reply(xcb_connection_t *c, xcb_randr_query_version_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_void_cookie_t
+xcb_randr_select_input(xcb_connection_t *c, xcb_window_t window, uint16_t enable) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_randr_get_screen_resources_current_cookie_t
+xcb_randr_get_screen_resources_current(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_randr_get_screen_resources_current_cookie_t) { sim_request(0) };
+}
+
+xcb_randr_get_screen_resources_current_reply_t *
+xcb_randr_get_screen_resources_current_reply(xcb_connection_t *c, xcb_randr_get_screen_resources_current_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_randr_output_t *
+xcb_randr_get_screen_resources_current_outputs(const xcb_randr_get_screen_resources_current_reply_t *R) {
+    return NULL;
+}
+
+int
+xcb_randr_get_screen_resources_current_outputs_length(const xcb_randr_get_screen_resources_current_reply_t *R) {
+    return 0;
+}
+
+xcb_randr_get_output_info_cookie_t
+xcb_randr_get_output_info(xcb_connection_t *c, xcb_randr_output_t output, xcb_timestamp_t config_timestamp) {
+    return (xcb_randr_get_output_info_cookie_t) { sim_request(0) };
+}
+
+xcb_randr_get_output_info_reply_t *
+xcb_randr_get_output_info_reply(xcb_connection_t *c, xcb_randr_get_output_info_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_randr_get_crtc_info_cookie_t
+xcb_randr_get_crtc_info(xcb_connection_t *c, xcb_randr_crtc_t crtc, xcb_timestamp_t config_timestamp) {
+    return (xcb_randr_get_crtc_info_cookie_t) { sim_request(0) };
+}
+
+xcb_randr_get_crtc_info_reply_t *
+xcb_randr_get_crtc_info_reply(xcb_connection_t *c, xcb_randr_get_crtc_info_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_xinerama_is_active_cookie_t
+xcb_xinerama_is_active(xcb_connection_t *c) {
+    return (xcb_xinerama_is_active_cookie_t) { sim_request(0) };
+}
+
+xcb_xinerama_is_active_reply_t *
+xcb_xinerama_is_active_reply(xcb_connection_t *c, xcb_xinerama_is_active_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_xinerama_query_screens_cookie_t
+xcb_xinerama_query_screens(xcb_connection_t *c) {
+    return (xcb_xinerama_query_screens_cookie_t) { sim_request(0) };
+}
+
+xcb_xinerama_query_screens_reply_t *
+xcb_xinerama_query_screens_reply(xcb_connection_t *c, xcb_xinerama_query_screens_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_xinerama_screen_info_t *
+xcb_xinerama_query_screens_screen_info(const xcb_xinerama_query_screens_reply_t *R) {
+    return NULL;
+}
+
+int
+xcb_xinerama_query_screens_screen_info_length(const xcb_xinerama_query_screens_reply_t *R) {
+    return 0;
+}
+
+xcb_sync_initialize_cookie_t
+xcb_sync_initialize(xcb_connection_t *c, uint8_t desired_major_version, uint8_t desired_minor_version) {
+    return (xcb_sync_initialize_cookie_t) { sim_request(0) };
+}
+
+xcb_sync_initialize_reply_t *
+xcb_sync_initialize_reply(xcb_connection_t *c, xcb_sync_initialize_cookie_t cookie, xcb_generic_error_t **e) {
+    return NULL;
+}
+
+xcb_void_cookie_t
+xcb_sync_create_alarm_aux(xcb_connection_t *c, xcb_sync_alarm_t id, uint32_t value_mask, const xcb_sync_create_alarm_value_list_t *value_list) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_sync_change_alarm_aux(xcb_connection_t *c, xcb_sync_alarm_t id, uint32_t value_mask, const xcb_sync_change_alarm_value_list_t *value_list) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_sync_destroy_alarm(xcb_connection_t *c, xcb_sync_alarm_t alarm) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_sync_destroy_alarm_checked(xcb_connection_t *c, xcb_sync_alarm_t alarm) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+/* icccm */
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_class_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_class_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_icccm_get_wm_class_reply_t *prop, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return 0;
+
+    const char *instance = sim_classes[window->class][0], *class = sim_classes[window->class][1];
+    char *strings = malloc(strlen(instance) + strlen(class) + 2);
+
+    strcpy(strings, instance);
+    strcpy(strings + strlen(instance) + 1, class);
+
+    prop->instance_name = strings;
+    prop->class_name = strings + strlen(instance) + 1;
+    prop->_reply = (void *) strings;
+
+    return 1;
+}
+
+void
+xcb_icccm_get_wm_class_reply_wipe(xcb_icccm_get_wm_class_reply_t *prop) {
+    free(prop->_reply);
+}
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_name_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_name_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_icccm_get_text_property_reply_t *prop, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return 0;
+
+    char *name = malloc(32);
+
+    prop->name_len = snprintf(name, 32, "%s %u", sim_classes[window->class][0], window->name);
+    prop->name = name;
+    prop->encoding = XCB_ATOM_STRING;
+    prop->format = 8;
+    prop->_reply = (void *) name;
+
+    return 1;
+}
+
+void
+xcb_icccm_get_text_property_reply_wipe(xcb_icccm_get_text_property_reply_t *prop) {
+    free(prop->_reply);
+}
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_transient_for_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_transient_for_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_window_t *prop, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window || !window->transient) return 0;
+
+    *prop = window->transient;
+
+    return 1;
+}
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_normal_hints_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_normal_hints_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_size_hints_t *hints, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window || !window->min_w) return 0;
+
+    memset(hints, 0, sizeof(*hints));
+    hints->flags = XCB_ICCCM_SIZE_HINT_P_MIN_SIZE;
+    hints->min_width = window->min_w;
+    hints->min_height = window->min_h;
+
+    return 1;
+}
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_hints_unchecked(xcb_connection_t *c, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_hints_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_icccm_wm_hints_t *hints, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return 0;
+
+    memset(hints, 0, sizeof(*hints));
+    hints->flags = XCB_ICCCM_WM_HINT_INPUT | (window->urgent ? XCB_ICCCM_WM_HINT_X_URGENCY : 0);
+    hints->input = 1;
+
+    return 1;
+}
+
+xcb_get_property_cookie_t
+xcb_icccm_get_wm_protocols(xcb_connection_t *c, xcb_window_t window, xcb_atom_t wm_protocol_atom) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_icccm_get_wm_protocols_reply(xcb_connection_t *c, xcb_get_property_cookie_t cookie, xcb_icccm_get_wm_protocols_reply_t *protocols, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window) return 0;
+
+    xcb_atom_t *atoms = malloc(2 * sizeof(*atoms));
+    unsigned n = 0;
+
+    if(window->protocols & SIM_DELETE) atoms[n++] = wm_delete_atom;
+    if(window->protocols & SIM_PING) atoms[n++] = ping_atom;
+
+    protocols->atoms_len = n;
+    protocols->atoms = atoms;
+    protocols->_reply = (void *) atoms;
+
+    return 1;
+}
+
+void
+xcb_icccm_get_wm_protocols_reply_wipe(xcb_icccm_get_wm_protocols_reply_t *protocols) {
+    free(protocols->_reply);
+}
+
+/* ewmh */
+
+xcb_intern_atom_cookie_t *
+xcb_ewmh_init_atoms(xcb_connection_t *c, xcb_ewmh_connection_t *ewmh) {
+    memset(ewmh, 0, sizeof(*ewmh));
+    ewmh->connection = c;
+
+    ewmh->_NET_SUPPORTED = sim_atom("_NET_SUPPORTED");
+    ewmh->_NET_CLIENT_LIST = sim_atom("_NET_CLIENT_LIST");
+    ewmh->_NET_NUMBER_OF_DESKTOPS = sim_atom("_NET_NUMBER_OF_DESKTOPS");
+    ewmh->_NET_CURRENT_DESKTOP = sim_atom("_NET_CURRENT_DESKTOP");
+    ewmh->_NET_ACTIVE_WINDOW = sim_atom("_NET_ACTIVE_WINDOW");
+    ewmh->_NET_WM_DESKTOP = sim_atom("_NET_WM_DESKTOP");
+    ewmh->_NET_WM_NAME = name_atom;
+    ewmh->_NET_WM_PING = ping_atom;
+    ewmh->_NET_WM_STATE = state_atom;
+    ewmh->_NET_WM_STATE_FULLSCREEN = fullscreen_atom;
+    ewmh->_NET_WM_STATE_ABOVE = sim_atom("_NET_WM_STATE_ABOVE");
+    ewmh->_NET_WM_STATE_DEMANDS_ATTENTION = sim_atom("_NET_WM_STATE_DEMANDS_ATTENTION");
+    ewmh->_NET_WM_SYNC_REQUEST = sim_atom("_NET_WM_SYNC_REQUEST");
+    ewmh->_NET_WM_SYNC_REQUEST_COUNTER = sim_atom("_NET_WM_SYNC_REQUEST_COUNTER");
+    ewmh->_NET_WM_WINDOW_TYPE = sim_atom("_NET_WM_WINDOW_TYPE");
+    ewmh->_NET_WM_WINDOW_TYPE_DIALOG = dialog_atom;
+
+    return sim_ewmh_cookies;
+}
+
+uint8_t
+xcb_ewmh_init_atoms_replies(xcb_ewmh_connection_t *ewmh, xcb_intern_atom_cookie_t *cookies, xcb_generic_error_t **e) {
+    sim_reply();
+    return 1;
+}
+
+void
+xcb_ewmh_connection_wipe(xcb_ewmh_connection_t *ewmh) {
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_supported(xcb_ewmh_connection_t *ewmh, int screen_nbr, uint32_t list_len, xcb_atom_t *list) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_number_of_desktops(xcb_ewmh_connection_t *ewmh, int screen_nbr, uint32_t number_of_desktops) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_current_desktop(xcb_ewmh_connection_t *ewmh, int screen_nbr, uint32_t new_current_desktop) {
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_active_window(xcb_ewmh_connection_t *ewmh, int screen_nbr, xcb_window_t new_active_window) {
+    return (xcb_void_cookie_t) { sim_request(new_active_window) };
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_client_list(xcb_ewmh_connection_t *ewmh, int screen_nbr, uint32_t list_len, xcb_window_t *list) {
+    sim.client_list = list_len;
+    return (xcb_void_cookie_t) { sim_request(0) };
+}
+
+xcb_void_cookie_t
+xcb_ewmh_set_wm_state(xcb_ewmh_connection_t *ewmh, xcb_window_t id, uint32_t list_len, xcb_atom_t *list) {
+    struct sim_window *window = sim_window(id);
+
+    if(window) {
+        window->fullscreen = false;
+
+        for(unsigned i = 0; i < list_len; i++) {
+            if(list[i] == fullscreen_atom) window->fullscreen = true;
+        }
+    }
+
+    return (xcb_void_cookie_t) { sim_request(id) };
+}
+
+xcb_get_property_cookie_t
+xcb_ewmh_get_wm_window_type(xcb_ewmh_connection_t *ewmh, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_ewmh_get_wm_window_type_reply(xcb_ewmh_connection_t *ewmh, xcb_get_property_cookie_t cookie, xcb_ewmh_get_atoms_reply_t *types, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window || !window->dialog) return 0;
+
+    types->atoms_len = 1;
+    types->atoms = malloc(sizeof(*types->atoms));
+    types->atoms[0] = dialog_atom;
+    types->_reply = (void *) types->atoms;
+
+    return 1;
+}
+
+void
+xcb_ewmh_get_atoms_reply_wipe(xcb_ewmh_get_atoms_reply_t *data) {
+    free(data->_reply);
+}
+
+xcb_get_property_cookie_t
+xcb_ewmh_get_wm_state_unchecked(xcb_ewmh_connection_t *ewmh, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_ewmh_get_wm_state_reply(xcb_ewmh_connection_t *ewmh, xcb_get_property_cookie_t cookie, xcb_ewmh_get_atoms_reply_t *state, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    if(!window || !window->fullscreen) return 0;
+
+    state->atoms_len = 1;
+    state->atoms = malloc(sizeof(*state->atoms));
+    state->atoms[0] = fullscreen_atom;
+    state->_reply = (void *) state->atoms;
+
+    return 1;
+}
+
+xcb_get_property_cookie_t
+xcb_ewmh_get_wm_name_unchecked(xcb_ewmh_connection_t *ewmh, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_ewmh_get_wm_name_reply(xcb_ewmh_connection_t *ewmh, xcb_get_property_cookie_t cookie, xcb_ewmh_get_utf8_strings_reply_t *data, xcb_generic_error_t **e) {
+    struct sim_window *window = sim_window(sim_cookie(cookie.sequence));
+
+    sim_reply();
+
+    // Every fourth client only sets WM_NAME.
+    if(!window || window->name % 4 == 0) return 0;
+
+    char *name = malloc(32);
+
+    data->strings_len = snprintf(name, 32, "%s %u", sim_classes[window->class][1], window->name);
+    data->strings = name;
+    data->_reply = (void *) name;
+
+    return 1;
+}
+
+void
+xcb_ewmh_get_utf8_strings_reply_wipe(xcb_ewmh_get_utf8_strings_reply_t *data) {
+    free(data->_reply);
+}
+
+xcb_get_property_cookie_t
+xcb_ewmh_get_wm_sync_request_counter(xcb_ewmh_connection_t *ewmh, xcb_window_t window) {
+    return (xcb_get_property_cookie_t) { sim_request(window) };
+}
+
+uint8_t
+xcb_ewmh_get_wm_sync_request_counter_reply(xcb_ewmh_connection_t *ewmh, xcb_get_property_cookie_t cookie, uint64_t *counter, xcb_generic_error_t **e) {
+    sim_reply();
+    return 0;
+}
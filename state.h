@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Shared state page. muon rewrites it after every batch of events or
+ * commands that changed something; readers map it read-only and copy it
+ * under a seqlock: the sequence is odd while an update is in progress, so
+ * a copy is consistent if the sequence was even and unchanged around it.
+ */
+
+#define STATE_PATH          "/dev/shm/muon-state"
+#define STATE_MAGIC         0x74736d6d
+#define STATE_VERSION       1
+#define STATE_MONITORS      16
+#define STATE_WINDOWS       64
+#define STATE_CLASS         32
+
+enum state_flags {
+    STATE_WINDOW_FOCUSED    = 1 << 0,
+    STATE_WINDOW_FLOATING   = 1 << 1,
+    STATE_WINDOW_FULLSCREEN = 1 << 2,
+    STATE_WINDOW_URGENT     = 1 << 3,
+    STATE_WINDOW_HIDDEN     = 1 << 4
+};
+
+struct state_window {
+    uint32_t id;
+    uint32_t flags;
+    uint32_t x, y, w, h;
+    char class[STATE_CLASS];
+};
+
+struct state_monitor {
+    uint32_t id;
+    uint32_t x, y, w, h;
+    uint32_t layout;
+    uint32_t root_count;
+    float root_size;
+    uint32_t mirror;
+    uint32_t window_gap;
+    uint32_t border_width;
+    uint32_t focused;
+    uint32_t window_count;
+    struct state_window windows[STATE_WINDOWS];
+};
+
+struct state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t sequence;
+    uint32_t focused_window;
+    uint32_t focused_monitor;
+    uint32_t monitor_count;
+    struct state_monitor monitors[STATE_MONITORS];
+};
+
+static inline void state_write_begin(struct state *state) {
+    __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void state_write_end(struct state *state) {
+    __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// The path is shared by every user of the machine, so a page that is not
+// our own is not muon's.
+static inline bool state_owned(int fd) {
+    struct stat st;
+
+    return !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_uid == getuid();
+}
+
+// MUON_STATE moves the page, like MUON_SOCKET moves the socket.
+static inline const char *state_path(void) {
+    const char *path = getenv("MUON_STATE");
+    return path ? path : STATE_PATH;
+}
+
+static inline const struct state *state_open(void) {
+    int fd = open(state_path(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+    if(fd < 0) return NULL;
+
+    if(!state_owned(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    const struct state *state = mmap(NULL, sizeof(*state), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(state == MAP_FAILED) return NULL;
+
+    if(state->magic != STATE_MAGIC || state->version != STATE_VERSION || state->size != sizeof(*state)) {
+        munmap((void *) state, sizeof(*state));
+        return NULL;
+    }
+
+    return state;
+}
+
+static inline void state_close(const struct state *state) {
+    munmap((void *) state, sizeof(*state));
+}
+
+// Copies a consistent snapshot into copy, retrying while muon is writing.
+static inline void state_read(const struct state *state, struct state *copy) {
+    for(;;) {
+        uint32_t begin = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+
+        if(begin & 1) continue;
+
+        memcpy(copy, state, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(__atomic_load_n(&state->sequence, __ATOMIC_RELAXED) == begin) return;
+    }
+}
+
+// Reads only the focused window id, without copying the whole page.
+static inline uint32_t state_focused_window(const struct state *state) {
+    for(;;) {
+        uint32_t begin = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+
+        if(begin & 1) continue;
+
+        uint32_t focused = __atomic_load_n(&state->focused_window, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(__atomic_load_n(&state->sequence, __ATOMIC_RELAXED) == begin) return focused;
+    }
+}
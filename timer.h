@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+/*
+ * Timers kept in a binary min-heap ordered by deadline. Like struct node,
+ * a timer is embedded in its owner and the callback gets the timer back,
+ * so timer_entry() recovers the owner. Starting, stopping and rescheduling
+ * are O(log n); the earliest deadline is always at the root.
+ */
+
+#define timer_entry(ptr, type, member) ((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
+
+#define TIMER_IDLE (~0u)
+
+struct timer {
+    unsigned long long deadline;
+    unsigned index;
+    void (*callback)(struct timer *);
+};
+
+struct timers {
+    struct timer **heap;
+    unsigned count, capacity;
+};
+
+static inline void __timer_swap(struct timers *timers, unsigned a, unsigned b) {
+    struct timer *t = timers->heap[a];
+    timers->heap[a] = timers->heap[b];
+    timers->heap[b] = t;
+    timers->heap[a]->index = a;
+    timers->heap[b]->index = b;
+}
+
+static inline void __timer_up(struct timers *timers, unsigned i) {
+    while(i && timers->heap[(i - 1) / 2]->deadline > timers->heap[i]->deadline) {
+        __timer_swap(timers, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static inline void __timer_down(struct timers *timers, unsigned i) {
+    for(;;) {
+        unsigned l = 2 * i + 1, r = l + 1, m = i;
+
+        if(l < timers->count && timers->heap[l]->deadline < timers->heap[m]->deadline) m = l;
+        if(r < timers->count && timers->heap[r]->deadline < timers->heap[m]->deadline) m = r;
+        if(m == i) return;
+
+        __timer_swap(timers, i, m);
+        i = m;
+    }
+}
+
+static inline void timer_init(struct timer *timer, void (*callback)(struct timer *)) {
+    timer->deadline = 0;
+    timer->index = TIMER_IDLE;
+    timer->callback = callback;
+}
+
+static inline bool timer_pending(const struct timer *timer) {
+    return timer->index != TIMER_IDLE;
+}
+
+static inline void timer_stop(struct timers *timers, struct timer *timer) {
+    unsigned i = timer->index;
+
+    if(i == TIMER_IDLE) return;
+
+    timer->index = TIMER_IDLE;
+
+    if(i == --timers->count) return;
+
+    timers->heap[i] = timers->heap[timers->count];
+    timers->heap[i]->index = i;
+    __timer_up(timers, i);
+    __timer_down(timers, timers->heap[i]->index);
+}
+
+// Schedules the timer at an absolute deadline, rescheduling if pending.
+static inline void timer_start(struct timers *timers, struct timer *timer, unsigned long long deadline) {
+    timer_stop(timers, timer);
+
+    if(timers->count == timers->capacity) {
+        timers->capacity = timers->capacity ? timers->capacity * 2 : 16;
+        timers->heap = realloc(timers->heap, timers->capacity * sizeof(*timers->heap));
+    }
+
+    timer->deadline = deadline;
+    timer->index = timers->count;
+    timers->heap[timers->count++] = timer;
+    __timer_up(timers, timer->index);
+}
+
+static inline struct timer *timer_first(const struct timers *timers) {
+    return timers->count ? timers->heap[0] : NULL;
+}
@@ -0,0 +1,43 @@
+#include <stdint.h>
+
+/*
+ * Trace file written by muon while tracing and read back by muor. A header
+ * is followed by records, each a fixed record header and length bytes of
+ * payload: a raw 32-byte X event as received, an IPC command as its
+ * space-separated text, or a window description taken when muon manages a
+ * window, which the replay uses to recreate the client.
+ */
+
+#define TRACE_MAGIC         0x6563746d
+#define TRACE_VERSION       1
+#define TRACE_EVENT_SIZE    32
+#define TRACE_NAME          64
+
+enum trace_type {
+    TRACE_EVENT,
+    TRACE_COMMAND,
+    TRACE_WINDOW
+};
+
+struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start;
+};
+
+struct trace_record {
+    uint64_t time;
+    uint16_t type;
+    uint16_t length;
+    uint32_t reserved;
+};
+
+struct trace_window {
+    uint32_t id;
+    uint32_t transient;
+    int32_t x, y;
+    uint32_t w, h;
+    uint32_t floating;
+    char class[TRACE_NAME];
+    char instance[TRACE_NAME];
+};